@@ -0,0 +1,159 @@
+//
+//  assignment.hpp
+//
+//  Assignment problem lower bound, valid for asymmetric distances. The
+//  rest of a tour gives each of the last city and the unvisited cities
+//  a successor among the unvisited cities and city 0, so it costs at
+//  least the cheapest such assignment (Hungarian algorithm, with row
+//  and column potentials). Adding a city x to a path removes the row
+//  of the last city and the column of x: the potentials stay feasible
+//  and at most one row is left unassigned, so a child is bounded from
+//  its parent with a single augmentation, O(n^2) instead of O(n^3).
+//
+
+#ifndef _assignment_hpp
+#define _assignment_hpp
+
+#include <cstdint>
+
+#include "graph.hpp"
+#include "path.hpp"
+
+class Assignment {
+private:
+	static const int INF = 1 << 29;
+
+	const Graph* _graph;
+	int _n;
+	int _last;					// row of the last city of the path
+	uint64_t _rows, _cols;		// cities still to leave, to enter
+	int _u[Path::MAX];			// row potentials
+	int _v[Path::MAX + 1];		// column potentials, _n is a dummy column
+	int _match[Path::MAX + 1];	// row assigned to each column, -1 if none
+
+	int cost(int i, int j) const { return i == j ? INF : _graph->distance(i, j); }
+	bool row(int i) const { return _rows & (1ULL << i); }
+	bool col(int j) const { return _cols & (1ULL << j); }
+
+	// assign the free row r, keeping the potentials feasible
+	void augment(int r)
+	{
+		int minv[Path::MAX + 1];
+		int way[Path::MAX + 1];
+		bool used[Path::MAX + 1];
+		int dummy = _n;
+		for (int j=0; j<=_n; j++) {
+			minv[j] = INF;
+			used[j] = false;
+		}
+		_match[dummy] = r;
+		_v[dummy] = 0;
+		int j0 = dummy;
+		do {
+			used[j0] = true;
+			int i0 = _match[j0];
+			int delta = INF, j1 = -1;
+			for (int j=0; j<_n; j++) {
+				if (!col(j) || used[j])
+					continue;
+				int cur = cost(i0, j) - _u[i0] - _v[j];
+				if (cur < minv[j]) {
+					minv[j] = cur;
+					way[j] = j0;
+				}
+				if (minv[j] < delta) {
+					delta = minv[j];
+					j1 = j;
+				}
+			}
+			for (int j=0; j<=_n; j++) {
+				if (j < _n && !col(j))
+					continue;
+				if (used[j]) {
+					_u[_match[j]] += delta;
+					_v[j] -= delta;
+				} else {
+					minv[j] -= delta;
+				}
+			}
+			j0 = j1;
+		} while (_match[j0] != -1);
+		do {
+			int j1 = way[j0];
+			_match[j0] = _match[j1];
+			j0 = j1;
+		} while (j0 != dummy);
+	}
+
+	int value() const
+	{
+		int sum = 0;
+		for (int j=0; j<_n; j++)
+			if (col(j))
+				sum += cost(_match[j], j);
+		return sum;
+	}
+
+public:
+	Assignment() : Assignment(nullptr) {}
+
+	Assignment(const Graph* g)
+	{
+		_graph = g;
+		_n = g ? g->size() : 0;
+		_last = 0;
+		_rows = _cols = 0;
+	}
+
+	// solve the problem left by p from scratch, returns a lower bound
+	// on any tour extending p; keeps the solution for extend()
+	int solve(const Path* p)
+	{
+		int size = p->size();
+		if (size == 0 || size > _n)
+			return p->distance();
+		_last = p->node(size - 1);
+		_rows = 1ULL << _last;
+		_cols = 1ULL << p->node(0);
+		for (int i=0; i<_n; i++)
+			if (!p->contains(i)) {
+				_rows |= 1ULL << i;
+				_cols |= 1ULL << i;
+			}
+		for (int j=0; j<=_n; j++) {
+			_v[j] = 0;
+			_match[j] = -1;
+		}
+		for (int i=0; i<_n; i++) {
+			_u[i] = 0;
+			if (row(i))
+				augment(i);
+		}
+		return p->distance() + value();
+	}
+
+	// lower bound on any tour extending child, the path given to the
+	// last solve() followed by one more city
+	int extend(const Path* child) const
+	{
+		int x = child->node(child->size() - 1);
+		Assignment a(*this);
+		int y = -1;
+		for (int j=0; j<_n; j++)
+			if (col(j) && _match[j] == _last)
+				y = j;
+		int r = _match[x];
+		a._rows &= ~(1ULL << _last);
+		a._cols &= ~(1ULL << x);
+		a._match[x] = -1;
+		a._last = x;
+		if (r != _last) {
+			// r lost its column x, and the column y of the last city is free
+			a._match[y] = -1;
+			a.augment(r);
+		}
+		return child->distance() + a.value();
+	}
+};
+
+#endif // _assignment_hpp
@@ -2,6 +2,138 @@
 // g++ -o atomic atomic.cpp
 
 #include <iostream>
+#include <cstdint>
+#include <cassert>
+#include <mutex>
+
+#ifndef _atomicstamped_hpp
+#define _atomicstamped_hpp
+
+// CAS contention counters, kept per thread by CasCount when built with
+// -DCAS_STATS and added to the process totals as each thread exits;
+// without it the hooks are empty. the queues count retries and tail
+// helping, the stamped references every CAS. the counts are for the
+// whole process, free lists included: CasCount::total() is the only
+// way to read them, take the difference around the code measured
+
+struct CasStats {
+	static const int BUCKETS = 12;	// retries 0, 1, 2-3, 4-7, ... 1024+
+
+	long attempts = 0;		// CAS tried
+	long failures = 0;		// CAS that failed
+	long helps = 0;			// tail swung forward for another thread
+	long operations = 0;	// queue operations done
+	long retries[BUCKETS] = {};	// operations by # of retries
+
+	CasStats& operator+=(const CasStats& s)
+	{
+		attempts += s.attempts;
+		failures += s.failures;
+		helps += s.helps;
+		operations += s.operations;
+		for (int i=0; i<BUCKETS; i++)
+			retries[i] += s.retries[i];
+		return *this;
+	}
+
+	CasStats operator-(const CasStats& s) const
+	{
+		CasStats d = *this;
+		d.attempts -= s.attempts;
+		d.failures -= s.failures;
+		d.helps -= s.helps;
+		d.operations -= s.operations;
+		for (int i=0; i<BUCKETS; i++)
+			d.retries[i] -= s.retries[i];
+		return d;
+	}
+
+	void print(std::ostream& out) const
+	{
+		out << "cas: " << attempts << " attempts, " << failures << " failed ("
+			<< (attempts ? 100. * failures / attempts : 0) << "%), " << helps << " tail helps, "
+			<< operations << " operations\n";
+		out << "retries per operation:";
+		for (int i=0; i<BUCKETS; i++) {
+			if (!retries[i])
+				continue;
+			long lo = i ? 1L << (i - 1) : 0, hi = (1L << i) - 1;
+			out << ' ' << lo;
+			if (i == BUCKETS - 1)
+				out << '+';
+			else if (hi > lo)
+				out << '-' << hi;
+			out << ':' << retries[i];
+		}
+		out << '\n';
+	}
+};
+
+class CasCount {
+private:
+	struct Local : CasStats {
+		~Local()
+		{
+			std::lock_guard<std::mutex> guard(_mutex);
+			_total += *this;
+		}
+	};
+
+	static inline std::mutex _mutex;
+	static inline CasStats _total;
+
+	static CasStats& local()
+	{
+		static thread_local Local l;
+		return l;
+	}
+
+public:
+#ifdef CAS_STATS
+	static const bool enabled = true;
+
+	static void cas(bool ok)
+	{
+		local().attempts ++;
+		if (!ok)
+			local().failures ++;
+	}
+
+	static void help() { local().helps ++; }
+
+	// a queue operation done after n failed attempts
+	static void retried(int n)
+	{
+		int b = 0;
+		while (n && b < CasStats::BUCKETS - 1) {
+			n >>= 1;
+			b ++;
+		}
+		local().operations ++;
+		local().retries[b] ++;
+	}
+#else
+	static const bool enabled = false;
+
+	static void cas(bool) {}
+	static void help() {}
+	static void retried(int) {}
+#endif
+
+	// counts of the threads gone and of the caller
+	static CasStats total()
+	{
+		std::lock_guard<std::mutex> guard(_mutex);
+		CasStats s = _total;
+		if (enabled)
+			s += local();
+		return s;
+	}
+};
+
+// pointer and stamp are read with acquire and written with release,
+// so that what was stored in a node before publishing a pointer to it
+// is seen by whoever loads that pointer
 
 
 template <class T>
@@ -42,7 +174,8 @@ public:
 		c.pair.stamp = stamp;
 		n.pair.ptr = next;
 		n.pair.stamp = nstamp;
-		bool res = __atomic_compare_exchange(&ref.val, &c.val, &n.val, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+		bool res = __atomic_compare_exchange(&ref.val, &c.val, &n.val, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+		CasCount::cas(res);
 		return res;
 	}
 
@@ -53,7 +186,7 @@ public:
 	T* get(uint64_t &stamp)
 	{
 		__ref u;
-		__atomic_load(&ref.val, &u.val, __ATOMIC_RELAXED);
+		__atomic_load(&ref.val, &u.val, __ATOMIC_ACQUIRE);
 		stamp = u.pair.stamp;
 		return u.pair.ptr;
 	}
@@ -65,7 +198,75 @@ public:
 		__ref u;
 		u.pair.ptr = ptr;
 		u.pair.stamp = stamp;
-		__atomic_store(&ref.val, &u.val, __ATOMIC_RELAXED);
+		__atomic_store(&ref.val, &u.val, __ATOMIC_RELEASE);
 	}
 			
 };
+
+// same interface, packed in 64 bits so that a native CAS is enough.
+// pointers must be below 2^48 (user space on x86-64 and aarch64, unless
+// 5-level page tables are asked for by mmap) and aligned to T: the
+// pointer takes 48 bits less its alignment bits, and the stamp the
+// other 16 plus those. stamps are compared and returned modulo that,
+// 2^20 for 16-byte aligned queue nodes: a CAS can only be fooled by a
+// thread preempted while the same node goes round that many times
+
+template <class T>
+class AtomicTagged {
+
+private:
+	uint64_t ref;
+
+	// computed on use, as T may not be complete yet when declaring
+	static constexpr int align_bits()
+	{
+		int bits = 0;
+		while ((2UL << bits) <= alignof(T))
+			bits ++;
+		return bits;
+	}
+
+	static constexpr int ptr_bits() { return 48 - align_bits(); }
+
+	static uint64_t pack(T* ptr, uint64_t stamp)
+	{
+		uint64_t p = (uint64_t) ptr;
+		assert((p >> 48) == 0 && (p & (alignof(T) - 1)) == 0);
+		return (p >> align_bits()) | (stamp << ptr_bits());
+	}
+
+public:
+
+	AtomicTagged(T* ptr, uint64_t stamp)
+	{
+		set(ptr, stamp);
+	}
+
+	AtomicTagged()
+	{
+		set(nullptr, 0);
+	}
+
+	bool cas(T* curr, T* next, uint64_t stamp, uint64_t nstamp)
+	{
+		uint64_t c = pack(curr, stamp);
+		bool res = __atomic_compare_exchange_n(&ref, &c, pack(next, nstamp), 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+		CasCount::cas(res);
+		return res;
+	}
+
+	T* get(uint64_t &stamp)
+	{
+		uint64_t u = __atomic_load_n(&ref, __ATOMIC_ACQUIRE);
+		stamp = u >> ptr_bits();
+		return (T*) ((u & ((1ULL << ptr_bits()) - 1)) << align_bits());
+	}
+
+	void set(T* ptr, uint64_t stamp)
+	{
+		__atomic_store_n(&ref, pack(ptr, stamp), __ATOMIC_RELEASE);
+	}
+
+};
+
+#endif // _atomicstamped_hpp
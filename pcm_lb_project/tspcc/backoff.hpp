@@ -0,0 +1,50 @@
+//
+//  backoff.hpp
+//
+//  Backoff policies for the CAS retry loops of the queues.
+//  A policy is created at the start of an operation and pause()
+//  is called after each failed CAS.
+//
+
+#ifndef _backoff_hpp
+#define _backoff_hpp
+
+#include <thread>
+
+static inline void cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__)
+	asm volatile("yield");
+#else
+	std::this_thread::yield();
+#endif
+}
+
+// retry at once
+class NoBackoff {
+public:
+	void pause() { }
+};
+
+// spin MIN, 2*MIN, 4*MIN... up to MAX iterations between retries,
+// then yield the processor once the limit is reached
+template <int MIN = 4, int MAX = 1024>
+class ExpBackoff {
+private:
+	int _limit = MIN;
+public:
+	void pause()
+	{
+		if (_limit >= MAX) {
+			std::this_thread::yield();
+			return;
+		}
+		for (int i=0; i<_limit; i++)
+			cpu_relax();
+		_limit <<= 1;
+	}
+};
+
+#endif // _backoff_hpp
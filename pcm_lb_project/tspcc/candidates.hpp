@@ -0,0 +1,157 @@
+//
+//  candidates.hpp
+//
+//  Sparse candidate adjacency of a graph: the edges that can still be
+//  in a tour shorter than a known one. With Held-Karp penalties, the
+//  cheapest 1-tree forced to use an edge outside the minimum 1-tree
+//  swaps it for the heaviest tree edge it closes a cycle with (the
+//  second edge of city 0 for edges of city 0). If even that 1-tree
+//  is not shorter than the known tour, no better tour uses the edge.
+//
+
+#ifndef _candidates_hpp
+#define _candidates_hpp
+
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+
+#include "graph.hpp"
+#include "path.hpp"
+#include "heldkarp.hpp"
+
+class Candidates {
+private:
+	int _n;
+	int _degree[Path::MAX];
+	int _next[Path::MAX][Path::MAX];	// surviving neighbours, nearest first
+	uint64_t _adjacent[Path::MAX];
+	const HeldKarp* _hk;
+
+	double w(int i, int j) const { return _hk->weight(i, j); }
+
+	// heaviest edge on the tree path from each city to every other one
+	void heaviest(const int* parent, double (*heavy)[Path::MAX]) const
+	{
+		for (int s=1; s<_n; s++) {
+			int stack[Path::MAX];
+			bool seen[Path::MAX] = {};
+			int top = 0;
+			stack[top ++] = s;
+			seen[s] = true;
+			heavy[s][s] = 0;
+			while (top) {
+				int u = stack[-- top];
+				for (int v=1; v<_n; v++) {
+					bool edge = (parent[v] == u || parent[u] == v);
+					if (edge && !seen[v]) {
+						seen[v] = true;
+						heavy[s][v] = std::max(heavy[s][u], w(u, v));
+						stack[top ++] = v;
+					}
+				}
+			}
+		}
+	}
+
+	// neighbour lists from the adjacency bits
+	void sort(const Graph* g)
+	{
+		for (int i=0; i<_n; i++) {
+			_degree[i] = 0;
+			for (int j=0; j<_n; j++)
+				if (allowed(i, j))
+					_next[i][_degree[i] ++] = j;
+			std::sort(_next[i], _next[i] + _degree[i],
+				[g, i](int x, int y) { return g->distance(i, x) < g->distance(i, y); });
+		}
+	}
+
+public:
+	// keep the edges of g that can be in a tour shorter than upper,
+	// with the penalties of hk
+	Candidates(const Graph* g, const HeldKarp* hk, int upper)
+	{
+		_n = g->size();
+		_hk = hk;
+		for (int i=0; i<_n; i++)
+			_adjacent[i] = 0;
+		if (_n < 4) {
+			// too small for a 1-tree, keep everything
+			for (int i=0; i<_n; i++)
+				_adjacent[i] = ((1ULL << _n) - 1) & ~(1ULL << i);
+			sort(g);
+			return;
+		}
+
+		// minimum spanning tree of 1..n-1, as HeldKarp builds it
+		double key[Path::MAX];
+		int parent[Path::MAX];
+		bool in[Path::MAX] = {};
+		for (int i=0; i<_n; i++)
+			key[i] = INFINITY;
+		key[1] = 0;
+		parent[1] = -1;
+		double weight = 0;
+		for (int k=1; k<_n; k++) {
+			int u = -1;
+			for (int i=1; i<_n; i++)
+				if (!in[i] && (u < 0 || key[i] < key[u]))
+					u = i;
+			in[u] = true;
+			weight += key[u];
+			for (int i=1; i<_n; i++)
+				if (!in[i] && w(u, i) < key[i]) {
+					key[i] = w(u, i);
+					parent[i] = u;
+				}
+		}
+		// and the two cheapest edges of 0
+		int a = -1, b = -1;
+		for (int i=1; i<_n; i++) {
+			if (a < 0 || w(0, i) < w(0, a)) {
+				b = a;
+				a = i;
+			} else if (b < 0 || w(0, i) < w(0, b)) {
+				b = i;
+			}
+		}
+		weight += w(0, a) + w(0, b);
+		double sum = 0;
+		for (int i=0; i<_n; i++)
+			sum += hk->penalty(i);
+		double root = weight - 2 * sum;
+
+		double heavy[Path::MAX][Path::MAX];
+		heaviest(parent, heavy);
+
+		for (int i=0; i<_n; i++)
+			for (int j=i+1; j<_n; j++) {
+				double forced;
+				if (i == 0)
+					forced = (j == a || j == b) ? root : root + w(0, j) - w(0, b);
+				else
+					forced = root + w(i, j) - heavy[i][j];
+				if (ceil(forced - 1e-6) < upper) {
+					_adjacent[i] |= 1ULL << j;
+					_adjacent[j] |= 1ULL << i;
+				}
+			}
+
+		sort(g);
+	}
+
+	bool allowed(int i, int j) const { return _adjacent[i] & (1ULL << j); }
+	int degree(int i) const { return _degree[i]; }
+	int next(int i, int k) const { return _next[i][k]; }
+
+	int edges() const
+	{
+		int e = 0;
+		for (int i=0; i<_n; i++)
+			e += _degree[i];
+		return e / 2;
+	}
+};
+
+#endif // _candidates_hpp
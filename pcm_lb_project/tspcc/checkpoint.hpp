@@ -0,0 +1,153 @@
+//
+//  checkpoint.hpp
+//
+//  Binary snapshot of a search: the incumbent tour, the node counter
+//  and the open frontier. Paths are stored as their city sequence,
+//  one byte per city; distances are recomputed from the graph on load.
+//
+//  layout: "TSPCKPT1", int32 cities, int64 nodes,
+//          uint8 tour size, tour cities,
+//          uint64 frontier size, { uint8 size, cities } per path
+//
+
+#ifndef _checkpoint_hpp
+#define _checkpoint_hpp
+
+#include <cstdio>
+#include <cstdint>
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "graph.hpp"
+#include "path.hpp"
+
+class Checkpoint {
+private:
+	static constexpr char MAGIC[8] = { 'T', 'S', 'P', 'C', 'K', 'P', 'T', '1' };
+
+	template <class V>
+	static void put(std::string& buf, V v)
+	{
+		buf.append((const char*) &v, sizeof(v));
+	}
+
+	template <class V>
+	static bool get(FILE* f, V& v)
+	{
+		return fread(&v, sizeof(v), 1, f) == 1;
+	}
+
+	static void put_path(std::string& buf, const Path* p)
+	{
+		put(buf, (uint8_t) p->size());
+		for (int i=0; i<p->size(); i++)
+			put(buf, (uint8_t) p->node(i));
+	}
+
+	static Path* get_path(FILE* f, Graph* g)
+	{
+		uint8_t size, node;
+		if (!get(f, size) || size > Path::MAX)
+			return nullptr;
+		Path* p = new Path(g);
+		for (int i=0; i<size; i++) {
+			if (!get(f, node) || node >= g->size()) {
+				delete p;
+				return nullptr;
+			}
+			p->add(node);
+		}
+		return p;
+	}
+
+	// all but the frontier paths
+	static void put_header(std::string& buf, Graph* g, const Path* shortest, long nodes, uint64_t count)
+	{
+		buf.append(MAGIC, sizeof(MAGIC));
+		put(buf, (int32_t) g->size());
+		put(buf, (int64_t) nodes);
+		put_path(buf, shortest);
+		put(buf, count);
+	}
+
+public:
+	struct State {
+		Path* shortest = nullptr;
+		long nodes = 0;
+		std::vector<Path*> frontier;
+	};
+
+	// encode a snapshot in memory, cheap enough to do while workers wait
+	static std::string encode(Graph* g, const Path* shortest, long nodes, const std::vector<Path*>& frontier)
+	{
+		std::string buf;
+		buf.reserve(32 + frontier.size() * 8);
+		put_header(buf, g, shortest, nodes, frontier.size());
+		for (const Path* p : frontier)
+			put_path(buf, p);
+		return buf;
+	}
+
+	// a frontier path as encode writes it, for frontiers encoded piecewise
+	static void append(std::string& buf, const Path* p)
+	{
+		put_path(buf, p);
+	}
+
+	// the same from a frontier of count paths in pieces written by append
+	static std::string encode(Graph* g, const Path* shortest, long nodes, uint64_t count,
+		const std::vector<std::string>& pieces)
+	{
+		size_t size = 32;
+		for (const std::string& s : pieces)
+			size += s.size();
+		std::string buf;
+		buf.reserve(size);
+		put_header(buf, g, shortest, nodes, count);
+		for (const std::string& s : pieces)
+			buf += s;
+		return buf;
+	}
+
+	// write buf to fname through a temporary file, so that a crash
+	// while writing leaves the previous checkpoint intact
+	static bool write(const std::string& fname, const std::string& buf)
+	{
+		std::string tmp = fname + ".tmp";
+		FILE* f = fopen(tmp.c_str(), "wb");
+		if (!f)
+			return false;
+		bool ok = fwrite(buf.data(), 1, buf.size(), f) == buf.size();
+		ok = (fclose(f) == 0) && ok;
+		return ok && rename(tmp.c_str(), fname.c_str()) == 0;
+	}
+
+	// read a checkpoint of a search on g, returns false on error
+	static bool read(const std::string& fname, Graph* g, State& state)
+	{
+		FILE* f = fopen(fname.c_str(), "rb");
+		if (!f)
+			return false;
+		char magic[sizeof(MAGIC)];
+		int32_t cities;
+		int64_t nodes = 0;
+		uint64_t count = 0;
+		bool ok = fread(magic, sizeof(magic), 1, f) == 1 && !memcmp(magic, MAGIC, sizeof(MAGIC))
+			&& get(f, cities) && cities == g->size() && get(f, nodes);
+		state.shortest = ok ? get_path(f, g) : nullptr;
+		ok = state.shortest && get(f, count);
+		for (uint64_t i=0; ok && i<count; i++) {
+			Path* p = get_path(f, g);
+			if (p)
+				state.frontier.push_back(p);
+			ok = (p != nullptr);
+		}
+		fclose(f);
+		state.nodes = nodes;
+		return ok;
+	}
+};
+
+#endif // _checkpoint_hpp
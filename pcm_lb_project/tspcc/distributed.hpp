@@ -0,0 +1,503 @@
+//
+//  distributed.hpp
+//
+//  Multi-process search over UNIX sockets. A coordinator keeps a pool
+//  of path prefixes and hands them to worker processes, one at a time.
+//  Workers explore their prefix depth-first, report shorter tours,
+//  which the coordinator broadcasts as the new bound, and give away
+//  their shallowest open paths when the coordinator asks for work on
+//  behalf of idle workers.
+//
+//  messages: uint8 type, uint32 payload length, payload
+//
+
+#ifndef _distributed_hpp
+#define _distributed_hpp
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+#include <string>
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "graph.hpp"
+#include "path.hpp"
+#include "tspfile.hpp"
+
+class Distributed {
+private:
+	enum Message : uint8_t {
+		MSG_WORK = 1,	// coordinator -> worker: a prefix to explore
+		MSG_BOUND,		// coordinator -> worker: shortest distance known
+		MSG_SPLIT,		// coordinator -> worker: give away open paths
+		MSG_STOP,		// coordinator -> worker: exit
+		MSG_SHORTER,	// worker -> coordinator: a shorter tour
+		MSG_TASKS,		// worker -> coordinator: open paths given away
+		MSG_DONE,		// worker -> coordinator: prefix explored, # of nodes
+	};
+
+	static const int SPLIT_CHECK = 1024;	// # of nodes between two looks at the socket
+	static const int TASKS_PER_WORKER = 8;	// initial pool size per worker
+	static const int CONNECT_TIMEOUT = 30;	// seconds for all workers to connect
+
+	// a worker, as the coordinator sees it
+	struct Peer {
+		int fd;
+		bool busy;
+		bool splitting;		// a MSG_SPLIT is outstanding
+		std::string out;	// messages not written yet
+	};
+
+	static bool full_write(int fd, const void* buf, size_t len)
+	{
+		const char* p = (const char*) buf;
+		while (len) {
+			ssize_t n = write(fd, p, len);
+			if (n < 0 && errno == EINTR)
+				continue;
+			if (n <= 0)
+				return false;
+			p += n;
+			len -= n;
+		}
+		return true;
+	}
+
+	static bool full_read(int fd, void* buf, size_t len)
+	{
+		char* p = (char*) buf;
+		while (len) {
+			ssize_t n = read(fd, p, len);
+			if (n < 0 && errno == EINTR)
+				continue;
+			if (n <= 0)
+				return false;
+			p += n;
+			len -= n;
+		}
+		return true;
+	}
+
+	static bool send(int fd, Message type, const std::string& payload = "")
+	{
+		uint8_t t = type;
+		uint32_t len = payload.size();
+		return full_write(fd, &t, 1) && full_write(fd, &len, 4) && full_write(fd, payload.data(), len);
+	}
+
+	static bool recv(int fd, Message& type, std::string& payload)
+	{
+		uint8_t t;
+		uint32_t len;
+		if (!full_read(fd, &t, 1) || !full_read(fd, &len, 4))
+			return false;
+		payload.resize(len);
+		type = (Message) t;
+		return full_read(fd, &payload[0], len);
+	}
+
+	// queue a message to p and write what the socket takes now: the
+	// coordinator never blocks on a worker that may be blocked writing
+	// to it in turn
+	static void post(Peer& p, Message type, const std::string& payload = "")
+	{
+		uint8_t t = type;
+		uint32_t len = payload.size();
+		p.out.append((const char*) &t, 1);
+		p.out.append((const char*) &len, 4);
+		p.out += payload;
+		flush(p);
+	}
+
+	// write what p's socket takes without blocking; false if it is gone
+	static bool flush(Peer& p)
+	{
+		size_t done = 0;
+		while (done < p.out.size()) {
+			ssize_t n = ::send(p.fd, p.out.data() + done, p.out.size() - done, MSG_DONTWAIT | MSG_NOSIGNAL);
+			if (n < 0 && errno == EINTR)
+				continue;
+			if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+				break;
+			if (n <= 0)
+				return false;
+			done += n;
+		}
+		p.out.erase(0, done);
+		return true;
+	}
+
+	// accept a connection from one of the workers pids, giving up if
+	// one of them exits first or none connects in time
+	static int accept_worker(int lfd, const std::vector<pid_t>& pids)
+	{
+		for (int waited = 0; waited < CONNECT_TIMEOUT * 10; waited++) {
+			struct pollfd p = { lfd, POLLIN, 0 };
+			int ready = poll(&p, 1, 100);
+			if (ready > 0 || (ready < 0 && errno != EINTR)) {
+				int fd = ready > 0 ? accept(lfd, 0, 0) : -1;
+				if (fd < 0)
+					std::cerr << "accept failed (" << std::strerror(errno) << ")\n";
+				return fd;
+			}
+			for (pid_t pid : pids) {
+				if (waitpid(pid, 0, WNOHANG) == pid) {
+					std::cerr << "worker " << pid << " exited before connecting\n";
+					return -1;
+				}
+			}
+		}
+		std::cerr << "workers did not connect within " << CONNECT_TIMEOUT << "s\n";
+		return -1;
+	}
+
+	// give up on the workers pids, and the peers connected so far
+	static long abandon(const std::vector<pid_t>& pids, std::vector<Peer>& peers)
+	{
+		for (Peer& p : peers)
+			close(p.fd);
+		for (pid_t pid : pids)
+			kill(pid, SIGTERM);
+		for (pid_t pid : pids)
+			waitpid(pid, 0, 0);
+		return -1;
+	}
+
+	// true if a message can be read without blocking
+	static bool pending(int fd)
+	{
+		struct pollfd p = { fd, POLLIN, 0 };
+		return poll(&p, 1, 0) > 0;
+	}
+
+	static void put_path(std::string& buf, const Path& p)
+	{
+		buf += (char) p.size();
+		for (int i=0; i<p.size(); i++)
+			buf += (char) p.node(i);
+	}
+
+	static bool get_path(const std::string& buf, size_t& pos, Path& p)
+	{
+		p.clear();
+		if (pos >= buf.size())
+			return false;
+		int size = (uint8_t) buf[pos ++];
+		if (size > Path::MAX || pos + size > buf.size())
+			return false;
+		for (int i=0; i<size; i++)
+			p.add((uint8_t) buf[pos ++]);
+		return true;
+	}
+
+	template <class V>
+	static std::string pack(V v)
+	{
+		return std::string((const char*) &v, sizeof(v));
+	}
+
+	template <class V>
+	static V unpack(const std::string& buf)
+	{
+		V v = 0;
+		memcpy(&v, buf.data(), std::min(sizeof(v), buf.size()));
+		return v;
+	}
+
+	// handle coordinator messages while exploring; returns false on STOP
+	static bool serve(int fd, int& bound, std::deque<Path>& open)
+	{
+		while (pending(fd)) {
+			Message type;
+			std::string payload;
+			if (!recv(fd, type, payload))
+				return false;
+			switch (type) {
+				case MSG_BOUND:
+					bound = std::min(bound, unpack<int32_t>(payload));
+					break;
+				case MSG_SPLIT: {
+					// the oldest open paths are the shallowest, hence the largest subtrees
+					std::string tasks;
+					size_t give = open.size() / 2;
+					tasks += pack((uint32_t) give);
+					for (size_t i=0; i<give; i++) {
+						put_path(tasks, open.front());
+						open.pop_front();
+					}
+					send(fd, MSG_TASKS, tasks);
+					break;
+				}
+				case MSG_STOP:
+					return false;
+				default:
+					break;
+			}
+		}
+		return true;
+	}
+
+	// depth-first exploration of prefix; returns false on STOP
+	static bool explore(int fd, Path& prefix, int& bound, long& nodes)
+	{
+		std::deque<Path> open;
+		open.push_back(prefix);
+		long pendingNodes = 0;
+		while (!open.empty()) {
+			Path current = open.back();
+			open.pop_back();
+			nodes ++;
+			if (++ pendingNodes == SPLIT_CHECK) {
+				pendingNodes = 0;
+				if (!serve(fd, bound, open))
+					return false;
+			}
+			if (current.leaf()) {
+				current.add(0);
+				if (current.distance() < bound) {
+					bound = current.distance();
+					std::string tour;
+					put_path(tour, current);
+					send(fd, MSG_SHORTER, tour);
+				}
+			} else if (current.distance() < bound) {
+				for (int i=current.max()-1; i>0; i--) {
+					if (!current.contains(i)) {
+						current.add(i);
+						open.push_back(current);
+						current.pop();
+					}
+				}
+			}
+		}
+		return true;
+	}
+
+	static int connect_to(const std::string& socket_path)
+	{
+		int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		struct sockaddr_un addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		strncpy(addr.sun_path, socket_path.c_str(), sizeof(addr.sun_path) - 1);
+		if (fd < 0 || connect(fd, (struct sockaddr*) &addr, sizeof(addr)) < 0)
+			return -1;
+		return fd;
+	}
+
+public:
+	// worker process: load fname, connect to the coordinator and explore
+	// the prefixes it sends until told to stop; returns the exit status
+	static int worker(const std::string& socket_path, const std::string& fname)
+	{
+		signal(SIGPIPE, SIG_IGN);
+		Graph* g = TSPFile::graph(fname);
+		int fd = connect_to(socket_path);
+		if (fd < 0) {
+			std::cerr << "cannot connect to " << socket_path << " (" << std::strerror(errno) << ")\n";
+			return 1;
+		}
+
+		int bound = INT32_MAX;
+		Path prefix(g);
+		Message type;
+		std::string payload;
+		while (recv(fd, type, payload)) {
+			if (type == MSG_BOUND) {
+				bound = std::min(bound, unpack<int32_t>(payload));
+			} else if (type == MSG_WORK) {
+				size_t pos = 0;
+				long nodes = 0;
+				if (!get_path(payload, pos, prefix))
+					break;
+				if (!explore(fd, prefix, bound, nodes))
+					break;
+				send(fd, MSG_DONE, pack((int64_t) nodes));
+			} else if (type == MSG_SPLIT) {
+				// asked while idle, nothing to give
+				send(fd, MSG_TASKS, pack((uint32_t) 0));
+			} else if (type == MSG_STOP) {
+				break;
+			}
+		}
+		close(fd);
+		delete g;
+		return 0;
+	}
+
+	// coordinator: fork processes workers connecting on socket_path,
+	// explore the tree rooted at [0] with them, leave the best tour in
+	// shortest and return the # of nodes explored, or -1 if the search
+	// failed (the reason on std::cerr)
+	static long coordinator(Graph* g, const std::string& fname, int processes,
+		const std::string& socket_path, Path* shortest, bool shorter, bool counters)
+	{
+		signal(SIGPIPE, SIG_IGN);
+		int lfd = socket(AF_UNIX, SOCK_STREAM, 0);
+		struct sockaddr_un addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		strncpy(addr.sun_path, socket_path.c_str(), sizeof(addr.sun_path) - 1);
+		unlink(socket_path.c_str());
+		if (lfd < 0 || bind(lfd, (struct sockaddr*) &addr, sizeof(addr)) < 0 || listen(lfd, processes) < 0) {
+			std::cerr << "cannot listen on " << socket_path << " (" << std::strerror(errno) << ")\n";
+			if (lfd >= 0)
+				close(lfd);
+			return -1;
+		}
+
+		std::vector<pid_t> pids;
+		std::vector<Peer> peers;
+		for (int i=0; i<processes; i++) {
+			pid_t pid = fork();
+			if (pid < 0) {
+				std::cerr << "cannot fork (" << std::strerror(errno) << ")\n";
+				close(lfd);
+				unlink(socket_path.c_str());
+				return abandon(pids, peers);
+			}
+			if (pid == 0) {
+				// a fresh tspcc --connect, loading the instance on its own;
+				// serve from the forked copy where that cannot be exec'ed
+				close(lfd);
+				execl("/proc/self/exe", "tspcc", "--connect", socket_path.c_str(), fname.c_str(), (char*) 0);
+				_exit(worker(socket_path, fname));
+			}
+			pids.push_back(pid);
+		}
+
+		// the pool starts with the prefixes of a breadth-first expansion
+		std::deque<Path> pool;
+		Path root(g);
+		root.add(0);
+		pool.push_back(root);
+		while (pool.size() < (size_t) processes * TASKS_PER_WORKER && !pool.front().leaf()) {
+			Path current = pool.front();
+			pool.pop_front();
+			for (int i=1; i<current.max(); i++) {
+				if (!current.contains(i)) {
+					current.add(i);
+					pool.push_back(current);
+					current.pop();
+				}
+			}
+		}
+
+		for (int i=0; i<processes; i++) {
+			int fd = accept_worker(lfd, pids);
+			if (fd < 0) {
+				close(lfd);
+				unlink(socket_path.c_str());
+				return abandon(pids, peers);
+			}
+			peers.push_back({ fd, false, false, "" });
+			post(peers.back(), MSG_BOUND, pack((int32_t) shortest->distance()));
+		}
+		close(lfd);
+		unlink(socket_path.c_str());
+
+		long nodes = 0;
+		long splits = 0;
+		while (true) {
+			// hand out the pool, ask busy workers for more when it runs dry
+			int idle = 0, splitting = 0;
+			for (Peer& p : peers) {
+				if (!p.busy && !pool.empty()) {
+					std::string work;
+					put_path(work, pool.front());
+					pool.pop_front();
+					post(p, MSG_WORK, work);
+					p.busy = true;
+				}
+				idle += !p.busy;
+				splitting += p.splitting;
+			}
+			if (idle && pool.empty() && !splitting) {
+				for (Peer& p : peers) {
+					if (p.busy) {
+						post(p, MSG_SPLIT);
+						p.splitting = true;
+						splitting ++;
+						splits ++;
+					}
+				}
+			}
+			if (idle == processes && pool.empty() && !splitting)
+				break;
+
+			std::vector<struct pollfd> fds;
+			for (Peer& p : peers)
+				fds.push_back({ p.fd, (short) (p.out.empty() ? POLLIN : POLLIN | POLLOUT), 0 });
+			if (poll(fds.data(), fds.size(), -1) < 0 && errno != EINTR) {
+				std::cerr << "cannot poll the workers (" << std::strerror(errno) << ")\n";
+				return abandon(pids, peers);
+			}
+			for (size_t i=0; i<peers.size(); i++) {
+				Peer& p = peers[i];
+				if ((fds[i].revents & POLLOUT) && !flush(p)) {
+					std::cerr << "worker " << i << " lost\n";
+					return abandon(pids, peers);
+				}
+				if (!(fds[i].revents & (POLLIN | POLLHUP)))
+					continue;
+				Message type;
+				std::string payload;
+				if (!recv(p.fd, type, payload)) {
+					std::cerr << "worker " << i << " lost\n";
+					return abandon(pids, peers);
+				}
+				size_t pos = 0;
+				Path path(g);
+				switch (type) {
+					case MSG_SHORTER:
+						if (get_path(payload, pos, path) && path.distance() < shortest->distance()) {
+							shortest->copy(&path);
+							if (shorter)
+								std::cout << "shorter: " << shortest << '\n';
+							for (Peer& o : peers)
+								if (&o != &p)
+									post(o, MSG_BOUND, pack((int32_t) shortest->distance()));
+						}
+						break;
+					case MSG_TASKS: {
+						p.splitting = false;
+						uint32_t count = unpack<uint32_t>(payload);
+						pos = 4;
+						for (uint32_t k=0; k<count && get_path(payload, pos, path); k++)
+							pool.push_back(path);
+						break;
+					}
+					case MSG_DONE:
+						nodes += unpack<int64_t>(payload);
+						p.busy = false;
+						break;
+					default:
+						break;
+				}
+			}
+		}
+
+		// all idle, the workers only read now: blocking is safe
+		for (Peer& p : peers) {
+			full_write(p.fd, p.out.data(), p.out.size());
+			send(p.fd, MSG_STOP);
+			close(p.fd);
+		}
+		for (pid_t pid : pids)
+			waitpid(pid, 0, 0);
+		if (counters)
+			std::cout << "split requests: " << splits << '\n';
+		return nodes;
+	}
+};
+
+#endif // _distributed_hpp
@@ -18,6 +18,7 @@ private:
 	int *_distances;
 	int *_x;
 	int *_y;
+	bool _placed;	// _distances belongs to someone else
 
 public:
 	Graph(int size) {
@@ -29,13 +30,15 @@ public:
 		_x = new int[size];
 		_y = new int[size];
 		_size = 0;
+		_placed = false;
 	}
 
 	~Graph()
 	{
 		delete _x;
 		delete _y;
-		delete _distances;
+		if (!_placed)
+			delete[] _distances;
 		_x = _y = _distances = 0;
 		_max_size = 0;
 	}
@@ -45,23 +48,61 @@ public:
 	int& sdistance(int i, int j) { return _distances[i + _max_size * j]; }
 	int add(int x, int y) { _x[_size] = x; _y[_size] = y; return _size ++; }
 
+	bool symmetric() const
+	{
+		for (int i=0; i<_size; i++)
+			for (int j=0; j<i; j++)
+				if (distance(i, j) != distance(j, i))
+					return false;
+		return true;
+	}
+
+	// bytes needed to place the distances elsewhere
+	size_t placement() const { return sizeof(int) * _max_size * _max_size; }
+
+	// move the distances to memory of placement() bytes provided by the
+	// caller (shared memory for instance), which must outlive the graph
+	// or the call to unplace()
+	void place(int* distances)
+	{
+		for (int i=0; i<_max_size * _max_size; i++)
+			distances[i] = _distances[i];
+		if (!_placed)
+			delete[] _distances;
+		_distances = distances;
+		_placed = true;
+	}
+
+	// copy the distances back from where place() put them, before that
+	// memory goes away
+	void unplace()
+	{
+		if (!_placed)
+			return;
+		int* distances = new int[_max_size * _max_size];
+		for (int i=0; i<_max_size * _max_size; i++)
+			distances[i] = _distances[i];
+		_distances = distances;
+		_placed = false;
+	}
+
 	void print(std::ostream& os, bool all=true) const
 	{
 		os << "     ";
 		for (int i=(all?0:1); i<_size; i++) {
-			char fmt[10];
-			snprintf(fmt, 8, "%5d", i);
+			char fmt[12];
+			snprintf(fmt, sizeof(fmt), "%5d", i);
 			os << fmt;
 		}
 		os << '\n';
 		for (int i=0; i<(_size-(all?0:1)); i++) {
-			char fmt[10];
-			snprintf(fmt, 8, "%5d", i);
+			char fmt[12];
+			snprintf(fmt, sizeof(fmt), "%5d", i);
 			os << fmt;
 			for (int j=0; j<(all?0:i); j++)
 				os << "   ..";
 			for (int j=(all?0:i+1); j<_size; j++) {
-				snprintf(fmt, 8, "%5d", distance(i, j));
+				snprintf(fmt, sizeof(fmt), "%5d", distance(i, j));
 				os << fmt;
 			}
 			os << '\n';
@@ -69,7 +110,7 @@ public:
 	}
 };
 
-std::ostream& operator <<(std::ostream& os, Graph* g)
+inline std::ostream& operator <<(std::ostream& os, Graph* g)
 {
 	g->print(os);
 	return os;
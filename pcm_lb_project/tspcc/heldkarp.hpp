@@ -0,0 +1,197 @@
+//
+//  heldkarp.hpp
+//
+//  Held-Karp lower bound. Subgradient optimisation at the root finds
+//  node penalties pi maximising the 1-tree bound; any tour costs its
+//  length under c(i,j) + pi[i] + pi[j], minus 2 * sum(pi). The same
+//  penalties then bound every path cheaply: the rest of a tour from
+//  the last city back to city 0 through the unvisited cities costs at
+//  least a spanning tree of these plus the cheapest edge at each end.
+//
+
+#ifndef _heldkarp_hpp
+#define _heldkarp_hpp
+
+#include <cmath>
+#include <vector>
+
+#include "graph.hpp"
+#include "path.hpp"
+
+class HeldKarp {
+private:
+	int _n;
+	double _pi[Path::MAX];
+	double _w[Path::MAX][Path::MAX];	// penalised distances
+	double _root;						// bound at the root
+	int _iterations;					// subgradient iterations run
+
+	void weigh(const Graph* g)
+	{
+		for (int i=0; i<_n; i++)
+			for (int j=0; j<_n; j++)
+				_w[i][j] = g->distance(i, j) + _pi[i] + _pi[j];
+	}
+
+	// minimum 1-tree (spanning tree of 1..n-1, plus the two cheapest
+	// edges of 0) under _w; fills the degrees, returns its weight
+	double one_tree(int* degree) const
+	{
+		double key[Path::MAX];
+		int parent[Path::MAX];
+		bool in[Path::MAX];
+		for (int i=0; i<_n; i++) {
+			degree[i] = 0;
+			key[i] = INFINITY;
+			in[i] = false;
+		}
+		double weight = 0;
+		key[1] = 0;
+		parent[1] = -1;
+		for (int k=1; k<_n; k++) {
+			int u = -1;
+			for (int i=1; i<_n; i++)
+				if (!in[i] && (u < 0 || key[i] < key[u]))
+					u = i;
+			in[u] = true;
+			weight += key[u];
+			if (parent[u] >= 0) {
+				degree[u] ++;
+				degree[parent[u]] ++;
+			}
+			for (int i=1; i<_n; i++)
+				if (!in[i] && _w[u][i] < key[i]) {
+					key[i] = _w[u][i];
+					parent[i] = u;
+				}
+		}
+		int a = -1, b = -1;
+		for (int i=1; i<_n; i++) {
+			if (a < 0 || _w[0][i] < _w[0][a]) {
+				b = a;
+				a = i;
+			} else if (b < 0 || _w[0][i] < _w[0][b]) {
+				b = i;
+			}
+		}
+		weight += _w[0][a] + _w[0][b];
+		degree[0] = 2;
+		degree[a] ++;
+		degree[b] ++;
+		return weight;
+	}
+
+	double penalties() const
+	{
+		double sum = 0;
+		for (int i=0; i<_n; i++)
+			sum += _pi[i];
+		return 2 * sum;
+	}
+
+public:
+	// penalties after at most iterations subgradient steps, with upper
+	// the length of a known tour (only used to size the steps)
+	HeldKarp(const Graph* g, int iterations, int upper)
+	{
+		_n = g->size();
+		for (int i=0; i<_n; i++)
+			_pi[i] = 0;
+		weigh(g);
+
+		int degree[Path::MAX];
+		double best[Path::MAX];
+		_root = one_tree(degree) - penalties();
+		for (int i=0; i<_n; i++)
+			best[i] = _pi[i];
+
+		double lambda = 2;
+		int stale = 0;
+		_iterations = 0;
+		while (_iterations < iterations && _n > 2) {
+			double bound = one_tree(degree) - penalties();
+			_iterations ++;
+			if (bound > _root + 1e-9) {
+				_root = bound;
+				for (int i=0; i<_n; i++)
+					best[i] = _pi[i];
+				stale = 0;
+			} else if (++ stale >= _n) {
+				lambda /= 2;
+				stale = 0;
+			}
+			int norm = 0;
+			for (int i=0; i<_n; i++)
+				norm += (degree[i] - 2) * (degree[i] - 2);
+			// a tour: the bound is the optimum
+			if (norm == 0 || lambda < 1e-6 || upper - bound < 1 - 1e-9)
+				break;
+			double step = lambda * (upper - bound) / norm;
+			for (int i=0; i<_n; i++)
+				_pi[i] += step * (degree[i] - 2);
+			weigh(g);
+		}
+		for (int i=0; i<_n; i++)
+			_pi[i] = best[i];
+		weigh(g);
+	}
+
+	int root() const { return ceil(_root - 1e-6); }
+	int iterations() const { return _iterations; }
+	double penalty(int i) const { return _pi[i]; }
+	double weight(int i, int j) const { return _w[i][j]; }
+
+	// lower bound on any tour extending p
+	int bound(const Path* p) const
+	{
+		int size = p->size();
+		if (size == 0 || size >= _n)
+			return p->distance();
+		int last = p->node(size - 1);
+
+		int rest[Path::MAX];
+		int m = 0;
+		double sum = 0;
+		for (int i=0; i<_n; i++)
+			if (!p->contains(i)) {
+				rest[m ++] = i;
+				sum += _pi[i];
+			}
+
+		// cheapest edges from last and from 0 into the rest
+		double in = INFINITY, out = INFINITY;
+		for (int k=0; k<m; k++) {
+			if (_w[last][rest[k]] < in)
+				in = _w[last][rest[k]];
+			if (_w[0][rest[k]] < out)
+				out = _w[0][rest[k]];
+		}
+
+		// spanning tree of the rest
+		double key[Path::MAX];
+		bool done[Path::MAX];
+		for (int k=0; k<m; k++) {
+			key[k] = INFINITY;
+			done[k] = false;
+		}
+		key[0] = 0;
+		double tree = 0;
+		for (int t=0; t<m; t++) {
+			int u = -1;
+			for (int k=0; k<m; k++)
+				if (!done[k] && (u < 0 || key[k] < key[u]))
+					u = k;
+			done[u] = true;
+			tree += key[u];
+			for (int k=0; k<m; k++)
+				if (!done[k] && _w[rest[u]][rest[k]] < key[k])
+					key[k] = _w[rest[u]][rest[k]];
+		}
+
+		// rest visited once each (degree 2), last and 0 left once
+		double b = tree + in + out - 2 * sum - _pi[last] - _pi[0];
+		return p->distance() + (int) ceil(b - 1e-6);
+	}
+};
+
+#endif // _heldkarp_hpp
@@ -0,0 +1,418 @@
+//
+//  heuristic.hpp
+//
+//  Short tours of instances far beyond the exact search: iterated
+//  local search. 2-opt and Or-opt moves are only tried towards each
+//  city's nearest neighbours, and don't-look bits keep the cities whose
+//  surroundings did not change out of the way, so that after a kick
+//  (two neighbouring blocks of the tour swapped) only the cities around
+//  it are looked at again. Each thread kicks a tour of its own, shares
+//  it when it beats the best one, and goes back to the best one when
+//  its own has not improved for a while. Distances are assumed
+//  symmetric.
+//
+
+#ifndef _heuristic_hpp
+#define _heuristic_hpp
+
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <random>
+#include <algorithm>
+#include <functional>
+#include <climits>
+
+#include "graph.hpp"
+
+class Heuristic {
+public:
+	static const int NEIGHBOURS = 10;	// candidate cities of each city
+	static const int SEGMENT = 3;		// longest segment moved by Or-opt
+	static const int KICK = 50;			// longest block swapped by a kick
+	static const int RESTART = 1000;	// kicks without improvement before taking the best tour
+	static const int CHECK = 64;		// kicks between two calls to going
+
+	// tells a worker whether to go on, given the kicks since the last call
+	typedef std::function<bool(long)> Going;
+	// told of each shorter tour, closed from city 0, and its length
+	typedef std::function<void(const std::vector<int>&, int)> Improved;
+
+private:
+	// a worker's tour: cities in order and the position of each, with
+	// the cities whose don't-look bit is off
+	struct Tour {
+		std::vector<int> city;
+		std::vector<int> pos;
+		int length;
+		std::deque<int> queue;
+		std::vector<char> queued;
+	};
+
+	const Graph* _g;
+	int _n;
+	int _k;					// neighbours per city
+	std::vector<int> _near;	// _k nearest cities of each, nearest first
+	long _stall;			// kicks without a shorter tour before stopping
+
+	std::mutex _mutex;
+	std::vector<int> _best;		// in tour order
+	std::atomic<int> _length;	// of _best
+	std::atomic<long> _stale;	// kicks since _best improved
+	std::atomic<long> _kicks, _improved, _restarts;
+
+	int d(int a, int b) const { return _g->distance(a, b); }
+	int next(const Tour& t, int c) const { return t.city[t.pos[c] + 1 == _n ? 0 : t.pos[c] + 1]; }
+	int prev(const Tour& t, int c) const { return t.city[t.pos[c] == 0 ? _n - 1 : t.pos[c] - 1]; }
+	const int* near(int c) const { return &_near[c * _k]; }
+
+	static void look(Tour& t, int c)
+	{
+		if (!t.queued[c]) {
+			t.queued[c] = 1;
+			t.queue.push_back(c);
+		}
+	}
+
+	// reverse the cities at positions i to j, going forward from i
+	void reverse(Tour& t, int i, int j) const
+	{
+		int len = (j - i + _n) % _n + 1;
+		for (int k=0; k<len/2; k++) {
+			int a = t.city[i], b = t.city[j];
+			t.city[i] = b;
+			t.pos[b] = i;
+			t.city[j] = a;
+			t.pos[a] = j;
+			i = (i + 1 == _n) ? 0 : i + 1;
+			j = (j == 0) ? _n - 1 : j - 1;
+		}
+	}
+
+	// replace edges (a, next a), (c, next c) by (a, c), (next a, next c),
+	// reversing whichever side of the tour is shorter
+	void two_opt_move(Tour& t, int a, int c) const
+	{
+		int b = next(t, a), d = next(t, c);
+		if ((t.pos[c] - t.pos[b] + _n) % _n < _n / 2)
+			reverse(t, t.pos[b], t.pos[c]);
+		else
+			reverse(t, t.pos[d], t.pos[a]);
+	}
+
+	// a 2-opt move adding an edge from a to one of its neighbours
+	bool two_opt(Tour& t, int a) const
+	{
+		for (int dir=0; dir<2; dir++) {
+			int b = dir ? prev(t, a) : next(t, a);
+			int ab = d(a, b);
+			for (int k=0; k<_k; k++) {
+				int c = near(a)[k];
+				int gain = ab - d(a, c);
+				if (gain <= 0)
+					break;
+				int e = dir ? prev(t, c) : next(t, c);
+				if (c == b || e == a)
+					continue;
+				gain += d(c, e) - d(b, e);
+				if (gain > 0) {
+					if (dir)
+						two_opt_move(t, b, e);
+					else
+						two_opt_move(t, a, c);
+					t.length -= gain;
+					look(t, a);
+					look(t, b);
+					look(t, c);
+					look(t, e);
+					return true;
+				}
+			}
+		}
+		return false;
+	}
+
+	// swap the blocks of lengths first and second starting at position i
+	void swap_blocks(Tour& t, int i, int first, int second) const
+	{
+		int j = (i + first) % _n;
+		reverse(t, i, (j + _n - 1) % _n);
+		reverse(t, j, (j + second - 1) % _n);
+		reverse(t, i, (i + first + second - 1) % _n);
+	}
+
+	// move the segment s..e (going forward) between u and v = next u,
+	// as e..s if flip, through the shorter side of the tour
+	void or_opt_move(Tour& t, int s, int e, int u, int v, bool flip) const
+	{
+		int len = (t.pos[e] - t.pos[s] + _n) % _n + 1;
+		int p = prev(t, s), q = next(t, e);
+		int ahead = (t.pos[u] - t.pos[q] + _n) % _n + 1;
+		int behind = (t.pos[p] - t.pos[v] + _n) % _n + 1;
+		if (ahead <= behind) {
+			// p [s..e][q..u] v: blocks swapped, the segment second
+			int i = t.pos[s];
+			if (!flip)
+				reverse(t, i, (i + len - 1) % _n);
+			reverse(t, (i + len) % _n, (i + len + ahead - 1) % _n);
+			reverse(t, i, (i + len + ahead - 1) % _n);
+		} else {
+			// u [v..p][s..e] q: the segment first
+			int i = t.pos[v];
+			reverse(t, i, (i + behind - 1) % _n);
+			if (!flip)
+				reverse(t, (i + behind) % _n, (i + behind + len - 1) % _n);
+			reverse(t, i, (i + behind + len - 1) % _n);
+		}
+	}
+
+	// an Or-opt move of a segment of up to SEGMENT cities starting at
+	// a, next to a neighbour of one of its ends
+	bool or_opt(Tour& t, int a) const
+	{
+		int e = a;
+		for (int len=1; len<=SEGMENT && len+3<=_n; len++, e=next(t, e)) {
+			int p = prev(t, a), q = next(t, e);
+			int removed = d(p, a) + d(e, q) - d(p, q);
+			if (removed <= 0)
+				continue;
+			int first = t.pos[a];
+			auto inside = [&](int c) { return (t.pos[c] - first + _n) % _n < len; };
+			for (int end=0; end<2; end++) {
+				int x = end ? e : a;
+				for (int k=0; k<_k; k++) {
+					int c = near(x)[k];
+					if (d(x, c) >= removed)
+						break;
+					if (inside(c))
+						continue;
+					for (int side=0; side<2; side++) {
+						int u = side ? prev(t, c) : c;
+						int v = side ? c : next(t, c);
+						if (inside(u) || inside(v))
+							continue;
+						int forward = d(u, a) + d(e, v) - d(u, v);
+						int backward = d(u, e) + d(a, v) - d(u, v);
+						int added = std::min(forward, backward);
+						if (added < removed) {
+							or_opt_move(t, a, e, u, v, backward < forward);
+							t.length -= removed - added;
+							look(t, p);
+							look(t, q);
+							look(t, a);
+							look(t, e);
+							look(t, u);
+							look(t, v);
+							return true;
+						}
+					}
+				}
+			}
+		}
+		return false;
+	}
+
+	// moves until every city's don't-look bit is on
+	void optimise(Tour& t) const
+	{
+		while (!t.queue.empty()) {
+			int a = t.queue.front();
+			t.queue.pop_front();
+			t.queued[a] = 0;
+			if (two_opt(t, a) || or_opt(t, a))
+				look(t, a);
+		}
+	}
+
+	// swap two short neighbouring blocks somewhere, a move the others
+	// do not undo in one step
+	void kick(Tour& t, std::mt19937& random) const
+	{
+		int most = std::min(KICK, (_n - 2) / 2);
+		std::uniform_int_distribution<int> at(0, _n - 1), size(1, most);
+		int i = at(random), first = size(random), second = size(random);
+		int a = t.city[(i + _n - 1) % _n];
+		int b = t.city[i], b2 = t.city[(i + first - 1) % _n];
+		int c = t.city[(i + first) % _n], c2 = t.city[(i + first + second - 1) % _n];
+		int f = t.city[(i + first + second) % _n];
+		t.length += d(a, c) + d(c2, b) + d(b2, f) - d(a, b) - d(b2, c) - d(c2, f);
+		swap_blocks(t, i, first, second);
+		look(t, a);
+		look(t, b);
+		look(t, b2);
+		look(t, c);
+		look(t, c2);
+		look(t, f);
+	}
+
+	void place(Tour& t, const std::vector<int>& cities, int length) const
+	{
+		t.city = cities;
+		for (int i=0; i<_n; i++)
+			t.pos[t.city[i]] = i;
+		t.length = length;
+	}
+
+	// nearest neighbour tour from city from: the first neighbour not
+	// in the tour yet is the nearest one, else look at all the others
+	Tour start(int from) const
+	{
+		Tour t;
+		t.pos.assign(_n, 0);
+		t.queued.assign(_n, 0);
+		t.length = 0;
+		std::vector<char> in(_n, 0);
+		int c = from;
+		for (int i=0; i<_n; i++) {
+			t.city.push_back(c);
+			t.pos[c] = i;
+			in[c] = 1;
+			look(t, c);
+			int to = -1;
+			for (int k=0; k<_k && to < 0; k++)
+				if (!in[near(c)[k]])
+					to = near(c)[k];
+			if (to < 0)
+				for (int j=0; j<_n; j++)
+					if (!in[j] && (to < 0 || d(c, j) < d(c, to)))
+						to = j;
+			if (to < 0)
+				to = from;
+			t.length += d(c, to);
+			c = to;
+		}
+		return t;
+	}
+
+	// share t if it beats the best tour
+	void offer(const Tour& t, const Improved& improved)
+	{
+		if (t.length >= _length.load(std::memory_order_relaxed))
+			return;
+		std::lock_guard<std::mutex> guard(_mutex);
+		if (t.length >= _length.load())
+			return;
+		_best = t.city;
+		_length = t.length;
+		_stale = 0;
+		_improved ++;
+		improved(tour(), t.length);
+	}
+
+public:
+	// stops when nobody found a shorter tour in stall kicks
+	Heuristic(const Graph* g, long stall) : _g(g), _n(g->size()), _stall(stall)
+	{
+		_k = std::min(NEIGHBOURS, _n - 1);
+		_near.resize(_n * _k);
+		std::vector<int> others;
+		for (int c=0; c<_n; c++) {
+			others.clear();
+			for (int j=0; j<_n; j++)
+				if (j != c)
+					others.push_back(j);
+			auto closer = [&](int i, int j) { return d(c, i) < d(c, j) || (d(c, i) == d(c, j) && i < j); };
+			std::partial_sort(others.begin(), others.begin() + _k, others.end(), closer);
+			std::copy(others.begin(), others.begin() + _k, _near.begin() + c * _k);
+		}
+		_length = INT_MAX;
+		_stale = 0;
+		_kicks = _improved = _restarts = 0;
+	}
+
+	int length() const { return _length.load(); }
+	long kicks() const { return _kicks.load(); }
+	long improved() const { return _improved.load(); }
+	long restarts() const { return _restarts.load(); }
+
+	// the best tour, closed from city 0 back to it
+	std::vector<int> tour() const
+	{
+		std::vector<int> t;
+		if (_best.empty())
+			return t;
+		int zero = std::find(_best.begin(), _best.end(), 0) - _best.begin();
+		for (int i=0; i<=_n; i++)
+			t.push_back(_best[(zero + i) % _n]);
+		return t;
+	}
+
+	// a worker, seeded with seed: kicks its tour until going says no,
+	// or the best tour is stale
+	void search(unsigned seed, const Going& going, const Improved& improved)
+	{
+		std::mt19937 random(seed);
+		Tour t = start(std::uniform_int_distribution<int>(0, _n - 1)(random));
+		optimise(t);
+		offer(t, improved);
+		if (_n < 8)
+			return;
+		std::vector<int> saved;
+		long failed = 0, pending = 0;
+		while (_stale.load(std::memory_order_relaxed) < _stall) {
+			saved = t.city;
+			int before = t.length;
+			kick(t, random);
+			optimise(t);
+			if (t.length < before) {
+				failed = 0;
+				offer(t, improved);
+			} else {
+				if (t.length > before)
+					place(t, saved, before);
+				failed ++;
+			}
+			_kicks.fetch_add(1, std::memory_order_relaxed);
+			_stale.fetch_add(1, std::memory_order_relaxed);
+			if (failed >= RESTART && t.length > _length.load(std::memory_order_relaxed)) {
+				std::lock_guard<std::mutex> guard(_mutex);
+				place(t, _best, _length.load());
+				failed = 0;
+				_restarts ++;
+			}
+			if (++ pending == CHECK) {
+				if (!going(pending))
+					return;
+				pending = 0;
+			}
+		}
+		going(pending);
+	}
+
+	// a plain 1-tree under the distances: loose, but the only bound
+	// cheap enough at this size
+	int one_tree() const
+	{
+		if (_n < 3)
+			return 0;
+		std::vector<int> key(_n, INT_MAX);
+		std::vector<char> in(_n, 0);
+		long weight = 0;
+		key[1] = 0;
+		for (int k=1; k<_n; k++) {
+			int u = -1;
+			for (int i=1; i<_n; i++)
+				if (!in[i] && (u < 0 || key[i] < key[u]))
+					u = i;
+			in[u] = 1;
+			weight += key[u];
+			for (int i=1; i<_n; i++)
+				if (!in[i] && d(u, i) < key[i])
+					key[i] = d(u, i);
+		}
+		int a = INT_MAX, b = INT_MAX;
+		for (int i=1; i<_n; i++) {
+			int w = d(0, i);
+			if (w < a) {
+				b = a;
+				a = w;
+			} else if (w < b) {
+				b = w;
+			}
+		}
+		return weight + a + b;
+	}
+};
+
+#endif // _heuristic_hpp
@@ -0,0 +1,155 @@
+//
+//  localsearch.hpp
+//
+//  2-opt and Or-opt improvement of a complete tour, given as the
+//  sequence of its cities (each once, the return to the first city
+//  implied). Both take first improvements until a local optimum.
+//  Distances are assumed symmetric, as TSPFile computes them.
+//
+
+#ifndef _localsearch_hpp
+#define _localsearch_hpp
+
+#include <vector>
+#include <algorithm>
+
+#include "graph.hpp"
+#include "path.hpp"
+
+class LocalSearch {
+private:
+	static int d(const Graph* g, const std::vector<int>& t, int i, int j)
+	{
+		return g->distance(t[i], t[j]);
+	}
+
+public:
+	static int length(const Graph* g, const std::vector<int>& tour)
+	{
+		int n = tour.size();
+		int len = 0;
+		for (int i=0; i<n; i++)
+			len += g->distance(tour[i], tour[(i + 1) % n]);
+		return len;
+	}
+
+	// reverse tour[i+1..j] when edges (i,i+1),(j,j+1) are longer than
+	// (i,j),(i+1,j+1); returns true if the tour was improved
+	static bool two_opt(const Graph* g, std::vector<int>& tour)
+	{
+		int n = tour.size();
+		bool improved = false;
+		bool again = true;
+		while (again) {
+			again = false;
+			for (int i=0; i<n-1; i++) {
+				for (int j=i+2; j<n; j++) {
+					int k = (j + 1) % n;
+					if (k == i)
+						continue;
+					int delta = d(g, tour, i, j) + d(g, tour, i+1, k) - d(g, tour, i, i+1) - d(g, tour, j, k);
+					if (delta < 0) {
+						std::reverse(tour.begin() + i + 1, tour.begin() + j + 1);
+						improved = again = true;
+					}
+				}
+			}
+		}
+		return improved;
+	}
+
+	// move a segment of 1 to 3 cities, possibly reversed, between two
+	// other neighbours; returns true if the tour was improved
+	static bool or_opt(const Graph* g, std::vector<int>& tour)
+	{
+		int n = tour.size();
+		bool improved = false;
+		bool again = true;
+		while (again) {
+			again = false;
+			for (int len=1; len<=3 && len<n-2; len++) {
+				for (int i=0; i<n && !again; i++) {
+					// segment tour[i..i+len-1] between p and q
+					int p = (i + n - 1) % n;
+					int first = i, last = (i + len - 1) % n;
+					int q = (last + 1) % n;
+					int removed = d(g, tour, p, first) + d(g, tour, last, q) - d(g, tour, p, q);
+					for (int j=(q + 1) % n; j != first && !again; j=(j + 1) % n) {
+						// insert between tour[j] and tour[j-1]
+						int a = (j + n - 1) % n;
+						int forward = d(g, tour, a, first) + d(g, tour, last, j) - d(g, tour, a, j);
+						int backward = d(g, tour, a, last) + d(g, tour, first, j) - d(g, tour, a, j);
+						if (std::min(forward, backward) < removed) {
+							std::vector<int> seg;
+							for (int k=0; k<len; k++)
+								seg.push_back(tour[(i + k) % n]);
+							if (backward < forward)
+								std::reverse(seg.begin(), seg.end());
+							int at = tour[j];
+							std::vector<int> rest;
+							for (int k=0; k<n; k++) {
+								int c = tour[(q + k) % n];
+								if (std::find(seg.begin(), seg.end(), c) != seg.end())
+									continue;
+								if (c == at)
+									rest.insert(rest.end(), seg.begin(), seg.end());
+								rest.push_back(c);
+							}
+							tour = rest;
+							improved = again = true;
+						}
+					}
+				}
+			}
+		}
+		return improved;
+	}
+
+	// alternate both until neither improves the tour
+	static void improve(const Graph* g, std::vector<int>& tour)
+	{
+		while (two_opt(g, tour) | or_opt(g, tour))
+			;
+	}
+
+	// nearest neighbour tour from city 0, following distances from
+	// each city (so also fine for asymmetric ones)
+	static std::vector<int> nearest(const Graph* g)
+	{
+		int n = g->size();
+		std::vector<int> tour(1, 0);
+		std::vector<bool> in(n, false);
+		in[0] = true;
+		for (int k=1; k<n; k++) {
+			int last = tour.back(), next = -1;
+			for (int i=0; i<n; i++)
+				if (!in[i] && (next < 0 || g->distance(last, i) < g->distance(last, next)))
+					next = i;
+			in[next] = true;
+			tour.push_back(next);
+		}
+		return tour;
+	}
+
+	// cities of a closed path, without the return to the first one
+	static std::vector<int> tour(const Path* p)
+	{
+		std::vector<int> t;
+		for (int i=0; i<p->size() - 1; i++)
+			t.push_back(p->node(i));
+		return t;
+	}
+
+	// closed path from city 0 following tour
+	static void path(const std::vector<int>& tour, Path* p)
+	{
+		int n = tour.size();
+		int start = std::find(tour.begin(), tour.end(), 0) - tour.begin();
+		p->clear();
+		for (int i=0; i<n; i++)
+			p->add(tour[(start + i) % n]);
+		p->add(0);
+	}
+};
+
+#endif // _localsearch_hpp
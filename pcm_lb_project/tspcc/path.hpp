@@ -13,7 +13,7 @@
 
 class Path {
 public:
-    static const int MAX = 10;
+    static const int MAX = 20;	// path capacity, tour closing node included
 private:
     int _size;
     int _distance;
@@ -41,6 +41,8 @@ public:
     int size() const { return _size; }
     bool leaf() const { return (_size == max()); }
     int distance() const { return _distance; }
+    int node(int i) const { return _nodes[i]; }
+    unsigned long long int mask() const { return _in; }
     void clear() { _in = 0; _size = _distance = 0; }
 
     void add(int node)
@@ -53,7 +55,7 @@ public:
             }
             _nodes[_size ++] = node;
         }
-        _in |= (1 << node);
+        _in |= (1ULL << node);
     }
 
     void pop()
@@ -64,15 +66,16 @@ public:
                 int node = _nodes[_size - 1];
                 int distance = _graph->distance(node, last);
                 _distance -= distance;
-                _in &= ~(1 << node);
             }
+            // a closed tour ends on its first node, which stays in
+            if (!_size || _nodes[0] != last)
+                _in &= ~(1ULL << last);
         }
-        //_in &= ~(1 << _nodes[_size]);
     }
 
     bool contains(int node) const
     {
-        return (_in & (1 << node));
+        return (_in & (1ULL << node));
 
         /*for (int i=0; i<_size; i++)
             if (_nodes[i] == node)
@@ -89,6 +92,7 @@ public:
         _graph = o->_graph;
         _size = o->_size;
         _distance = o->_distance;
+        _in = o->_in;
         for (int i=0; i<_size; i++)
             _nodes[i] = o->_nodes[i];
     }
@@ -102,7 +106,7 @@ public:
     }
 };
 
-std::ostream& operator <<(std::ostream& os, Path* p)
+inline std::ostream& operator <<(std::ostream& os, Path* p)
 {
     p->print(os);
     return os;
@@ -0,0 +1,195 @@
+//
+//  prefix.hpp
+//
+//  Frontier entries sharing their prefixes: a queued path is its last
+//  city, distance and city mask, plus a counted reference to the
+//  entry it extends. Siblings share everything but their last city, so
+//  a frontier entry takes 24 bytes instead of a whole Path, and the
+//  Path is rebuilt only when a worker starts on it. Entries come from
+//  slabs shared by all threads: a thread keeps the entries it frees
+//  for itself up to a slab's worth, then hands them to a lock-free
+//  pool the others allocate from. reset() frees the slabs once a
+//  search has dropped all its entries.
+//
+
+#ifndef _prefix_hpp
+#define _prefix_hpp
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <vector>
+
+#include "path.hpp"
+
+class Prefix {
+private:
+	static const int SLAB = 4096;	// entries allocated at once
+
+	static_assert(Path::MAX <= 32, "city masks are 32 bits");
+
+	Prefix* _parent;	// also the next free entry
+	uint32_t _mask;
+	int _distance;
+	std::atomic<int> _refs;
+	uint8_t _city;
+	uint8_t _size;
+
+	static inline std::mutex _slabsMutex;
+	static inline std::vector<Prefix*> _slabs;		// every slab, for reset()
+	static inline std::atomic<Prefix*> _pool{nullptr};	// entries handed over by threads
+	static inline std::atomic<unsigned> _generation{0};	// bumped by reset()
+
+	// per thread: entries to allocate from, entries freed here (with
+	// their tail and count), and the generation they belong to
+	static inline thread_local Prefix* _free = nullptr;
+	static inline thread_local Prefix* _released = nullptr;
+	static inline thread_local Prefix* _last = nullptr;
+	static inline thread_local int _count = 0;
+	static inline thread_local unsigned _seen = 0;
+
+	// forget the lists of this thread if their slabs were freed since
+	static void refresh()
+	{
+		unsigned g = _generation.load(std::memory_order_relaxed);
+		if (_seen != g) {
+			_free = _released = _last = nullptr;
+			_count = 0;
+			_seen = g;
+		}
+	}
+
+	static Prefix* alloc()
+	{
+		refresh();
+		if (_released) {
+			Prefix* p = _released;
+			_released = p->_parent;
+			if (-- _count == 0)
+				_last = nullptr;
+			return p;
+		}
+		if (!_free)
+			// take everything the other threads handed over at once,
+			// a single taker cannot suffer from ABA
+			_free = _pool.exchange(nullptr, std::memory_order_acquire);
+		if (!_free) {
+			Prefix* slab = static_cast<Prefix*>(::operator new(SLAB * sizeof(Prefix)));
+			for (int i=0; i<SLAB; i++)
+				slab[i]._parent = (i + 1 < SLAB) ? &slab[i + 1] : nullptr;
+			std::lock_guard<std::mutex> lock(_slabsMutex);
+			_slabs.push_back(slab);
+			_free = slab;
+		}
+		Prefix* p = _free;
+		_free = p->_parent;
+		return p;
+	}
+
+	// keep e for this thread, handing a slab's worth to the pool
+	static void recycle(Prefix* e)
+	{
+		e->_parent = _released;
+		_released = e;
+		if (!_last)
+			_last = e;
+		if (++ _count < SLAB)
+			return;
+		Prefix* head = _pool.load(std::memory_order_relaxed);
+		do
+			_last->_parent = head;
+		while (!_pool.compare_exchange_weak(head, _released, std::memory_order_release, std::memory_order_relaxed));
+		_released = _last = nullptr;
+		_count = 0;
+	}
+
+	static Prefix* make(Prefix* parent, const Path* p, int size)
+	{
+		Prefix* e = new (alloc()) Prefix;
+		e->_parent = parent;
+		e->_city = p->node(size - 1);
+		e->_size = size;
+		e->_refs.store(1, std::memory_order_relaxed);
+		e->_mask = 0;
+		e->_distance = 0;
+		if (parent) {
+			parent->_refs.fetch_add(1, std::memory_order_relaxed);
+			e->_mask = parent->_mask;
+		}
+		e->_mask |= 1U << e->_city;
+		return e;
+	}
+
+public:
+	int size() const { return _size; }
+	int distance() const { return _distance; }
+	uint32_t mask() const { return _mask; }
+
+	// entry for p, one city longer than the path of parent (which the
+	// caller holds a reference to); the reference returned is the caller's
+	static Prefix* child(Prefix* parent, const Path* p)
+	{
+		Prefix* e = make(parent, p, p->size());
+		e->_distance = p->distance();
+		return e;
+	}
+
+	// a chain of entries for all of p, reusing the ancestor of near (a
+	// reference of the caller's) for the first shared cities
+	static Prefix* chain(const Path* p, Prefix* near = nullptr, int shared = 0)
+	{
+		Prefix* e = near;
+		while (e && e->_size > shared)
+			e = e->_parent;
+		if (e)
+			e->_refs.fetch_add(1, std::memory_order_relaxed);
+		for (int i=(e ? e->_size + 1 : 1); i<=p->size(); i++) {
+			Prefix* next = make(e, p, i);
+			if (e)
+				release(e);
+			e = next;
+		}
+		e->_distance = p->distance();
+		return e;
+	}
+
+	// drop a reference, freeing the entries nobody refers to anymore
+	static void release(Prefix* e)
+	{
+		refresh();
+		while (e && e->_refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+			Prefix* parent = e->_parent;
+			recycle(e);
+			e = parent;
+		}
+	}
+
+	// free every slab; no entry may be referenced anymore, and no other
+	// thread may be allocating or releasing
+	static void reset()
+	{
+		std::lock_guard<std::mutex> lock(_slabsMutex);
+		for (Prefix* slab : _slabs)
+			::operator delete(slab);
+		_slabs.clear();
+		_pool.store(nullptr);
+		_generation ++;
+	}
+
+	// rebuild the whole path into p
+	void path(Path* p) const
+	{
+		int nodes[Path::MAX];
+		const Prefix* e = this;
+		for (int i=_size-1; i>=0; i--) {
+			nodes[i] = e->_city;
+			e = e->_parent;
+		}
+		p->clear();
+		for (int i=0; i<_size; i++)
+			p->add(nodes[i]);
+	}
+};
+
+#endif // _prefix_hpp
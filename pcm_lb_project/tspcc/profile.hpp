@@ -0,0 +1,218 @@
+//
+//  profile.hpp
+//
+//  Scoped timing zones and histograms, compiled in with -DPROFILE
+//  (make profile, into tspcc-profile) and to nothing otherwise. A zone
+//  is charged the time spent in it less the zones opened inside it, so
+//  the zones of a thread add up to its run time. Counts are kept per
+//  thread and added to the process totals when the thread exits. Times
+//  are read with rdtsc where there is one, and scaled by the steady
+//  clock.
+//
+
+#ifndef _profile_hpp
+#define _profile_hpp
+
+#include <iostream>
+#include <iomanip>
+#include <cstdint>
+#include <chrono>
+#include <mutex>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+class Profile {
+public:
+	enum Zone {
+		OTHER,		// outside any zone
+		BRANCH,		// generating and filtering children
+		BOUND,		// lower bounds
+		ALLOC,		// making and freeing frontier entries
+		QUEUE,		// frontier queue operations
+		IDLE,		// waiting for work
+		ZONES
+	};
+
+	// counts of values in power of two buckets
+	class Histogram {
+	private:
+		static const int BUCKETS = 40;
+		long _count[BUCKETS];
+
+	public:
+		Histogram() { clear(); }
+
+		void clear()
+		{
+			for (int i=0; i<BUCKETS; i++)
+				_count[i] = 0;
+		}
+
+		// bucket b holds values in [2^(b-1), 2^b), bucket 0 holds 0
+		void add(uint64_t value)
+		{
+			int b = 0;
+			while (value && b < BUCKETS - 1) {
+				value >>= 1;
+				b ++;
+			}
+			_count[b] ++;
+		}
+
+		void add(const Histogram& h)
+		{
+			for (int i=0; i<BUCKETS; i++)
+				_count[i] += h._count[i];
+		}
+
+		void print(std::ostream& out, const char* unit) const
+		{
+			for (int b=0; b<BUCKETS; b++)
+				if (_count[b])
+					out << "  [" << (b ? 1ULL << (b - 1) : 0) << ", " << (1ULL << b) << ") " << unit
+						<< ": " << _count[b] << '\n';
+		}
+	};
+
+	// a time stamp, in ticks
+	static uint64_t stamp()
+	{
+#if defined(__x86_64__) || defined(__i386__)
+		return __rdtsc();
+#else
+		return std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+	}
+
+#ifdef PROFILE
+	static const bool enabled = true;
+#else
+	static const bool enabled = false;
+#endif
+
+private:
+	struct Counts {
+		uint64_t ticks[ZONES];
+		long entries[ZONES];
+		Histogram tasks;	// nodes per task
+		Histogram idle;		// microseconds per idle spell
+
+		Counts()
+		{
+			for (int i=0; i<ZONES; i++) {
+				ticks[i] = 0;
+				entries[i] = 0;
+			}
+		}
+
+		void add(const Counts& c)
+		{
+			for (int i=0; i<ZONES; i++) {
+				ticks[i] += c.ticks[i];
+				entries[i] += c.entries[i];
+			}
+			tasks.add(c.tasks);
+			idle.add(c.idle);
+		}
+	};
+
+	// a thread's counts, added to the totals as it exits
+	struct Local : Counts {
+		Zone zone;
+		uint64_t since;	// when zone was last entered or resumed
+
+		Local() : zone(OTHER), since(stamp()) {}
+
+		void flush()
+		{
+			uint64_t now = stamp();
+			this->ticks[zone] += now - since;
+			since = now;
+			std::lock_guard<std::mutex> guard(_mutex);
+			_total.add(*this);
+			*static_cast<Counts*>(this) = Counts();
+		}
+
+		~Local() { flush(); }
+	};
+
+	static inline std::mutex _mutex;
+	static inline Counts _total;
+	static inline const uint64_t _startTicks = stamp();
+	static inline const std::chrono::steady_clock::time_point _start = std::chrono::steady_clock::now();
+	static inline thread_local Local _local;
+
+	// charge the time since the last switch to the zone left, enter to
+	static Zone enter(Zone to)
+	{
+		Local& l = _local;
+		uint64_t now = stamp();
+		Zone from = l.zone;
+		l.ticks[from] += now - l.since;
+		l.since = now;
+		l.zone = to;
+		return from;
+	}
+
+public:
+	// seconds per tick, measured over the run so far
+	static double scale()
+	{
+		std::chrono::duration<double> secs = std::chrono::steady_clock::now() - _start;
+		uint64_t ticks = stamp() - _startTicks;
+		return ticks ? secs.count() / ticks : 0;
+	}
+
+#ifdef PROFILE
+	// charges its lifetime to a zone, less the scopes opened inside it
+	class Scope {
+	private:
+		Zone _outer;
+	public:
+		Scope(Zone z) { _outer = enter(z); _local.entries[z] ++; }
+		~Scope() { enter(_outer); }
+	};
+
+	static void task(long nodes) { _local.tasks.add(nodes); }
+	static void idle(double seconds) { _local.idle.add(seconds * 1e6); }
+#else
+	class Scope {
+	public:
+		Scope(Zone) {}
+	};
+
+	static void task(long) {}
+	static void idle(double) {}
+#endif
+
+	// the totals of the threads gone: the workers, not the caller
+	// waiting for them
+	static void report(std::ostream& out)
+	{
+		if (!enabled)
+			return;
+		static const char* names[ZONES] = { "other", "branch", "bound", "alloc", "queue", "idle" };
+		std::lock_guard<std::mutex> guard(_mutex);
+		double scale = Profile::scale();
+		uint64_t all = 0;
+		for (int i=0; i<ZONES; i++)
+			all += _total.ticks[i];
+		out << "zones (seconds over all threads, share, entries, ns per entry):\n";
+		for (int i=0; i<ZONES; i++) {
+			double secs = _total.ticks[i] * scale;
+			out << "  " << std::left << std::setw(8) << names[i] << std::right << std::fixed << std::setprecision(4)
+				<< secs << "s " << std::setw(6) << std::setprecision(1) << (all ? 100. * _total.ticks[i] / all : 0) << "% ";
+			out << _total.entries[i];
+			if (_total.entries[i])
+				out << ' ' << (1e9 * secs / _total.entries[i]);
+			out << '\n' << std::defaultfloat << std::setprecision(6);
+		}
+		out << "nodes per task:\n";
+		_total.tasks.print(out, "nodes");
+		out << "idle spells:\n";
+		_total.idle.print(out, "us");
+	}
+};
+
+#endif // _profile_hpp
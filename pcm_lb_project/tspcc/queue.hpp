@@ -10,6 +10,7 @@
 #define _queue_hpp
 
 #include "atomicstamped.hpp"
+#include "backoff.hpp"
 
 class EmptyQueueException
 {
@@ -21,21 +22,66 @@ public:
 };
 
 
-template <class T>
+// B is the backoff policy applied after a failed CAS,
+// R the stamped reference: AtomicStamped (128 bits) or AtomicTagged (64 bits)
+template <class T, class B = NoBackoff, template <class> class R = AtomicStamped>
 class Queue {
 private:
+	// 16-byte aligned, which AtomicTagged turns into 4 more stamp bits
 	template <class U>
-	struct Node
+	struct alignas(16) alignas(U) Node
 	{
 		U _value;
-		AtomicStamped<Node<U> > _nextref;
-		Node(U v) : _nextref(nullptr, 0) { this->_value = v; }
+		R<Node<U> > _nextref;
+		Node<U>* _free;		// next in the free list
+		Node(U v) : _nextref(nullptr, 0) { this->_value = v; this->_free = nullptr; }
 	};
 
-	AtomicStamped<Node<T> > _headref;
-	AtomicStamped<Node<T> > _tailref;
+	R<Node<T> > _headref;
+	R<Node<T> > _tailref;
+	R<Node<T> > _freeref;
+
+	// nodes are not given back to the allocator while the queue lives:
+	// a preempted thread may still read a node that was dequeued since,
+	// so dequeued nodes go to a free list and are reused from there.
+	// a reused node keeps counting its next stamp, so that stale CAS on it fail
+
+	Node<T>* alloc(T value)
+	{
+		uint64_t stamp, nextStamp;
+		B backoff;
+
+		while (true) {
+			Node<T>* node = this->_freeref.get(stamp);
+			if (node == nullptr)
+				return new Node<T>(value);
+			Node<T>* next = __atomic_load_n(&node->_free, __ATOMIC_RELAXED);
+			if (this->_freeref.cas(node, next, stamp, stamp+1)) {
+				node->_value = value;
+				node->_nextref.get(nextStamp);
+				node->_nextref.set(nullptr, nextStamp+1);
+				return node;
+			}
+			backoff.pause();
+		}
+	}
+
+	void release(Node<T>* node)
+	{
+		uint64_t stamp;
+		B backoff;
+
+		while (true) {
+			Node<T>* top = this->_freeref.get(stamp);
+			__atomic_store_n(&node->_free, top, __ATOMIC_RELAXED);
+			if (this->_freeref.cas(top, node, stamp, stamp+1))
+				return;
+			backoff.pause();
+		}
+	}
 
 public:
+	typedef T value_type;
 
 	Queue()
 	{
@@ -43,48 +89,182 @@ public:
 		Node<T>* node = new Node<T>(value);
 		this->_headref.set(node, 0);
 		this->_tailref.set(node, 0);
+		this->_freeref.set(nullptr, 0);
+	}
+
+	~Queue()
+	{
+		uint64_t stamp;
+		Node<T>* node = this->_headref.get(stamp);
+		while (node) {
+			Node<T>* next = node->_nextref.get(stamp);
+			delete node;
+			node = next;
+		}
+		node = this->_freeref.get(stamp);
+		while (node) {
+			Node<T>* next = node->_free;
+			delete node;
+			node = next;
+		}
 	}
 
 	void enqueue(T value)
 	{
-		Node<T>* node = new Node<T>(value);
+		Node<T>* node = alloc(value);
 		uint64_t tailStamp, nextStamp, stamp;
+		B backoff;
+		int retries = -1;
 
 		while (true) {
+			retries ++;
 			Node<T>* tail = this->_tailref.get(tailStamp);
 			Node<T>* next = tail->_nextref.get(nextStamp);
 			if (tail == this->_tailref.get(stamp) && stamp == tailStamp) {
 				if (next == nullptr) {
 					if (tail->_nextref.cas(next, node, nextStamp, nextStamp+1)) {
 						this->_tailref.cas(tail, node, tailStamp, tailStamp+1);
+						CasCount::retried(retries);
 						return;
 					}
+					backoff.pause();
 				} else {
 					this->_tailref.cas(tail, next, tailStamp, tailStamp+1);
+					CasCount::help();
 				}
 			}
 		}
 	}
 
-	T dequeue()
+	// enqueue values [first, last) with a single link of the tail:
+	// the nodes are chained privately, then spliced in one CAS
+
+	template <class It>
+	void enqueue_bulk(It first, It last)
+	{
+		if (first == last)
+			return;
+		uint64_t tailStamp, nextStamp, stamp;
+		Node<T>* chain = alloc(*first);
+		Node<T>* end = chain;
+		for (++first; first != last; ++first) {
+			Node<T>* node = alloc(*first);
+			end->_nextref.get(stamp);
+			end->_nextref.set(node, stamp+1);
+			end = node;
+		}
+		B backoff;
+		int retries = -1;
+
+		while (true) {
+			retries ++;
+			Node<T>* tail = this->_tailref.get(tailStamp);
+			Node<T>* next = tail->_nextref.get(nextStamp);
+			if (tail == this->_tailref.get(stamp) && stamp == tailStamp) {
+				if (next == nullptr) {
+					if (tail->_nextref.cas(next, chain, nextStamp, nextStamp+1)) {
+						// others help the tail along the chain, one node at a time
+						this->_tailref.cas(tail, end, tailStamp, tailStamp+1);
+						CasCount::retried(retries);
+						return;
+					}
+					backoff.pause();
+				} else {
+					this->_tailref.cas(tail, next, tailStamp, tailStamp+1);
+					CasCount::help();
+				}
+			}
+		}
+	}
+
+	// take the value at the head into value,
+	// returns false (and leaves value alone) if the queue is empty
+
+	bool try_dequeue(T& value)
 	{
 		uint64_t tailStamp, headStamp, nextStamp, stamp;
+		B backoff;
+		int retries = -1;
 
 		while (true) {
+			retries ++;
 			Node<T>* head = this->_headref.get(headStamp);
 			Node<T>* tail = this->_tailref.get(tailStamp);
 			Node<T>* next = head->_nextref.get(nextStamp);
 			if (head == this->_headref.get(stamp) && stamp == headStamp) {
 				if (head == tail) {
-					if (next == nullptr)
-						throw(EmptyQueueException("Cannot dequeue from an empty queue."));
+					if (next == nullptr) {
+						CasCount::retried(retries);
+						return false;
+					}
 					this->_tailref.cas(tail, next, tailStamp, tailStamp+1);
+					CasCount::help();
 				} else {
-					T value = next->_value;
+					T v = next->_value;
 					if (this->_headref.cas(head, next, headStamp, headStamp+1)) {
-						delete head;
-						return value;
+						release(head);
+						value = v;
+						CasCount::retried(retries);
+						return true;
+					}
+					backoff.pause();
+				}
+			}
+		}
+	}
+
+	T dequeue()
+	{
+		T value;
+		if (!try_dequeue(value))
+			throw(EmptyQueueException("Cannot dequeue from an empty queue."));
+		return value;
+	}
+
+	// dequeue up to max values into out with a single swing of the head,
+	// never past the tail; returns the number of values, 0 if empty
+
+	int dequeue_bulk(T* out, int max)
+	{
+		uint64_t tailStamp, headStamp, nextStamp, stamp;
+		B backoff;
+		int retries = -1;
+
+		while (true) {
+			retries ++;
+			Node<T>* head = this->_headref.get(headStamp);
+			Node<T>* tail = this->_tailref.get(tailStamp);
+			Node<T>* next = head->_nextref.get(nextStamp);
+			if (head == this->_headref.get(stamp) && stamp == headStamp) {
+				if (head == tail) {
+					if (next == nullptr) {
+						CasCount::retried(retries);
+						return 0;
+					}
+					this->_tailref.cas(tail, next, tailStamp, tailStamp+1);
+					CasCount::help();
+				} else {
+					// like dequeue, values are read before the CAS validates them
+					int n = 0;
+					Node<T>* last = next;
+					out[n ++] = last->_value;
+					while (n < max && last != tail) {
+						Node<T>* node = last->_nextref.get(nextStamp);
+						if (node == nullptr)
+							break;
+						last = node;
+						out[n ++] = last->_value;
+					}
+					if (this->_headref.cas(head, last, headStamp, headStamp+1)) {
+						while (head != last) {
+							Node<T>* node = head->_nextref.get(nextStamp);
+							release(head);
+							head = node;
+						}
+						CasCount::retried(retries);
+						return n;
 					}
+					backoff.pause();
 				}
 			}
 		}
@@ -0,0 +1,235 @@
+//
+//  ringqueue.hpp
+//
+//  Bounded multi-producer multi-consumer queue over an array of cells
+//  (D. Vyukov's sequence-counter design), with the same enqueue/dequeue
+//  interface as Queue. When the ring is full, values go to an unbounded
+//  Queue on the side, so enqueue never fails; FIFO order is then only
+//  kept within the ring and within the overflow. The CAS loops on the
+//  head and tail are counted like those of Queue (see CasCount); a
+//  value taken from the overflow counts as a second operation.
+//
+
+#include <iostream>
+
+#ifndef _ringqueue_hpp
+#define _ringqueue_hpp
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "queue.hpp"
+
+#define CACHE_LINE 64
+
+template <class T>
+class RingQueue {
+private:
+	struct Cell
+	{
+		std::atomic<size_t> _seq;
+		T _value;
+	};
+
+	// head and tail on their own lines, consumers and producers
+	// do not invalidate each other's counter
+	alignas(CACHE_LINE) std::atomic<size_t> _head;
+	alignas(CACHE_LINE) std::atomic<size_t> _tail;
+	alignas(CACHE_LINE) Cell* _cells;
+	size_t _mask;
+	Queue<T> _overflow;
+	std::atomic<size_t> _overflowed;	// # of values sent to overflow
+
+public:
+	typedef T value_type;
+
+
+	// capacity is rounded up to a power of two
+	RingQueue(size_t capacity = 1 << 16)
+	{
+		size_t size = 2;
+		while (size < capacity)
+			size <<= 1;
+		_mask = size - 1;
+		_cells = new Cell[size];
+		for (size_t i=0; i<size; i++)
+			_cells[i]._seq.store(i, std::memory_order_relaxed);
+		_head.store(0, std::memory_order_relaxed);
+		_tail.store(0, std::memory_order_relaxed);
+		_overflowed.store(0, std::memory_order_relaxed);
+	}
+
+	~RingQueue()
+	{
+		delete[] _cells;
+		_cells = 0;
+	}
+
+	size_t capacity() const { return _mask + 1; }
+	size_t overflowed() const { return _overflowed.load(std::memory_order_relaxed); }
+
+	// put value in the ring, returns false if the ring is full
+
+	bool try_enqueue(T value)
+	{
+		Cell* cell;
+		size_t pos = _tail.load(std::memory_order_relaxed);
+		int retries = -1;
+		while (true) {
+			retries ++;
+			cell = &_cells[pos & _mask];
+			size_t seq = cell->_seq.load(std::memory_order_acquire);
+			intptr_t dif = (intptr_t) seq - (intptr_t) pos;
+			if (dif == 0) {
+				bool ok = _tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed);
+				CasCount::cas(ok);
+				if (ok)
+					break;
+			} else if (dif < 0) {
+				CasCount::retried(retries);
+				return false;
+			} else {
+				pos = _tail.load(std::memory_order_relaxed);
+			}
+		}
+		cell->_value = value;
+		cell->_seq.store(pos + 1, std::memory_order_release);
+		CasCount::retried(retries);
+		return true;
+	}
+
+	// take a value from the ring, returns false if the ring is empty
+
+	bool try_dequeue_ring(T& value)
+	{
+		Cell* cell;
+		size_t pos = _head.load(std::memory_order_relaxed);
+		int retries = -1;
+		while (true) {
+			retries ++;
+			cell = &_cells[pos & _mask];
+			size_t seq = cell->_seq.load(std::memory_order_acquire);
+			intptr_t dif = (intptr_t) seq - (intptr_t) (pos + 1);
+			if (dif == 0) {
+				bool ok = _head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed);
+				CasCount::cas(ok);
+				if (ok)
+					break;
+			} else if (dif < 0) {
+				CasCount::retried(retries);
+				return false;
+			} else {
+				pos = _head.load(std::memory_order_relaxed);
+			}
+		}
+		value = cell->_value;
+		cell->_seq.store(pos + _mask + 1, std::memory_order_release);
+		CasCount::retried(retries);
+		return true;
+	}
+
+private:
+	// claim up to n consecutive free cells with one CAS on the tail,
+	// returns the number of cells claimed, starting at pos
+
+	size_t claim(std::atomic<size_t>& end, size_t n, size_t offset, size_t& pos)
+	{
+		pos = end.load(std::memory_order_relaxed);
+		int retries = -1;
+		while (true) {
+			retries ++;
+			size_t k = 0;
+			while (k < n) {
+				size_t seq = _cells[(pos + k) & _mask]._seq.load(std::memory_order_acquire);
+				if (seq != pos + k + offset)
+					break;
+				k ++;
+			}
+			if (k == 0) {
+				size_t seq = _cells[pos & _mask]._seq.load(std::memory_order_acquire);
+				if ((intptr_t) seq - (intptr_t) (pos + offset) < 0) {
+					CasCount::retried(retries);
+					return 0;
+				}
+				pos = end.load(std::memory_order_relaxed);
+				continue;
+			}
+			bool ok = end.compare_exchange_weak(pos, pos + k, std::memory_order_relaxed);
+			CasCount::cas(ok);
+			if (ok) {
+				CasCount::retried(retries);
+				return k;
+			}
+		}
+	}
+
+public:
+	template <class It>
+	void enqueue_bulk(It first, It last)
+	{
+		while (first != last) {
+			size_t pos;
+			size_t k = claim(_tail, last - first, 0, pos);
+			if (k == 0) {
+				// ring full, the rest goes to the overflow
+				std::vector<T> rest(first, last);
+				_overflowed.fetch_add(rest.size(), std::memory_order_relaxed);
+				_overflow.enqueue_bulk(rest.begin(), rest.end());
+				return;
+			}
+			for (size_t i=0; i<k; i++, ++first) {
+				Cell* cell = &_cells[(pos + i) & _mask];
+				cell->_value = *first;
+				cell->_seq.store(pos + i + 1, std::memory_order_release);
+			}
+		}
+	}
+
+	int dequeue_bulk(T* out, int max)
+	{
+		size_t pos;
+		size_t k = claim(_head, max, 1, pos);
+		for (size_t i=0; i<k; i++) {
+			Cell* cell = &_cells[(pos + i) & _mask];
+			out[i] = cell->_value;
+			cell->_seq.store(pos + i + _mask + 1, std::memory_order_release);
+		}
+		if (k == 0)
+			return _overflow.dequeue_bulk(out, max);
+		return k;
+	}
+
+	void enqueue(T value)
+	{
+		if (!try_enqueue(value)) {
+			_overflowed.fetch_add(1, std::memory_order_relaxed);
+			_overflow.enqueue(value);
+		}
+	}
+
+	bool try_dequeue(T& value)
+	{
+		if (try_dequeue_ring(value))
+			return true;
+		return _overflow.try_dequeue(value);
+	}
+
+	T dequeue()
+	{
+		T value;
+		if (try_dequeue_ring(value))
+			return value;
+		return _overflow.dequeue();
+	}
+
+	bool empty()
+	{
+		size_t head = _head.load(std::memory_order_relaxed);
+		size_t tail = _tail.load(std::memory_order_relaxed);
+		return head == tail && _overflow.empty();
+	}
+};
+
+#endif // _ringqueue_hpp
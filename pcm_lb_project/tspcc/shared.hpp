@@ -0,0 +1,318 @@
+//
+//  shared.hpp
+//
+//  Multi-process search over a POSIX shared memory segment. Forked
+//  worker processes share, without copying, the distance matrix, the
+//  incumbent and a bounded lock-free pool of path prefixes (the same
+//  sequence-counter ring as RingQueue, laid out inside the segment).
+//  Each process searches depth-first on its own stack and feeds the
+//  pool with its shallowest paths when the pool runs low. A worker
+//  that dies fails the whole search: the others are told to stop and
+//  killed, since its subtree is lost and no tour could be called
+//  optimal.
+//
+//  segment: Segment header, CAPACITY cells, distance matrix
+//
+
+#ifndef _shared_hpp
+#define _shared_hpp
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <string>
+#include <deque>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <csignal>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "graph.hpp"
+#include "path.hpp"
+
+#define CACHE_LINE 64
+
+class SharedSearch {
+private:
+	static const size_t CAPACITY = 4096;	// prefixes in the pool, a power of two
+	static const int SHARE_CHECK = 64;		// # of nodes between two looks at the pool
+	static const int COUNT_FLUSH = 4096;	// # of nodes between two counter updates
+	static const int REAP_WAIT = 10;		// ms between two looks at the workers
+
+	// a path as its cities, the distance is recomputed from the graph
+	struct Prefix
+	{
+		uint8_t size;
+		uint8_t nodes[Path::MAX];
+
+		void set(const Path& p)
+		{
+			size = p.size();
+			for (int i=0; i<size; i++)
+				nodes[i] = p.node(i);
+		}
+
+		void get(Path& p) const
+		{
+			p.clear();
+			for (int i=0; i<size; i++)
+				p.add(nodes[i]);
+		}
+	};
+
+	struct Cell
+	{
+		std::atomic<size_t> seq;
+		Prefix prefix;
+	};
+
+	// atomics in the segment are used from several processes,
+	// which is only valid for lock-free (address-free) ones
+	static_assert(std::atomic<size_t>::is_always_lock_free, "shared atomics must be lock-free");
+	static_assert(std::atomic<int>::is_always_lock_free, "shared atomics must be lock-free");
+	static_assert(std::atomic<long>::is_always_lock_free, "shared atomics must be lock-free");
+	static_assert(std::atomic<bool>::is_always_lock_free, "shared atomics must be lock-free");
+
+	struct Segment
+	{
+		alignas(CACHE_LINE) std::atomic<size_t> head;
+		alignas(CACHE_LINE) std::atomic<size_t> tail;
+		alignas(CACHE_LINE) std::atomic<int> bound;		// incumbent distance
+		std::atomic<int> busy;		// # of processes holding paths
+		std::atomic<long> nodes;	// # of paths expanded
+		std::atomic<bool> lock;		// guards shortest
+		std::atomic<bool> stop;		// a worker died, the others give up
+		Prefix shortest;
+
+		Cell* cells() { return (Cell*) (this + 1); }
+		int* distances() { return (int*) (cells() + CAPACITY); }
+	};
+
+	static bool push(Segment* seg, const Path& p)
+	{
+		Cell* cells = seg->cells();
+		size_t pos = seg->tail.load(std::memory_order_relaxed);
+		while (true) {
+			Cell* cell = &cells[pos & (CAPACITY - 1)];
+			intptr_t dif = (intptr_t) cell->seq.load(std::memory_order_acquire) - (intptr_t) pos;
+			if (dif == 0) {
+				if (seg->tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+					cell->prefix.set(p);
+					cell->seq.store(pos + 1, std::memory_order_release);
+					return true;
+				}
+			} else if (dif < 0) {
+				return false;
+			} else {
+				pos = seg->tail.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	static bool pop(Segment* seg, Path& p)
+	{
+		Cell* cells = seg->cells();
+		size_t pos = seg->head.load(std::memory_order_relaxed);
+		while (true) {
+			Cell* cell = &cells[pos & (CAPACITY - 1)];
+			intptr_t dif = (intptr_t) cell->seq.load(std::memory_order_acquire) - (intptr_t) (pos + 1);
+			if (dif == 0) {
+				if (seg->head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+					cell->prefix.get(p);
+					cell->seq.store(pos + CAPACITY, std::memory_order_release);
+					return true;
+				}
+			} else if (dif < 0) {
+				return false;
+			} else {
+				pos = seg->head.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	static size_t pooled(Segment* seg)
+	{
+		return seg->tail.load(std::memory_order_relaxed) - seg->head.load(std::memory_order_relaxed);
+	}
+
+	static void update_shortest(Segment* seg, const Path& p)
+	{
+		bool unlocked = false;
+		while (!seg->lock.compare_exchange_weak(unlocked, true, std::memory_order_acquire)) {
+			// the holder may have died with the lock
+			if (seg->stop.load(std::memory_order_relaxed))
+				return;
+			unlocked = false;
+		}
+		if (p.distance() < seg->bound.load(std::memory_order_relaxed)) {
+			seg->shortest.set(p);
+			seg->bound.store(p.distance(), std::memory_order_relaxed);
+		}
+		seg->lock.store(false, std::memory_order_release);
+	}
+
+	static void worker(Segment* seg, Graph* g, int processes)
+	{
+		std::deque<Path> stack;
+		Path current(g);
+		long pending = 0;
+		while (!seg->stop.load(std::memory_order_relaxed)) {
+			// same termination rule as the threads: busy before polling
+			seg->busy ++;
+			if (!pop(seg, current)) {
+				if (-- seg->busy == 0)
+					break;
+				std::this_thread::yield();
+				continue;
+			}
+			stack.push_back(current);
+
+			while (!stack.empty()) {
+				current = stack.back();
+				stack.pop_back();
+				if (++ pending % SHARE_CHECK == 0) {
+					// keep the pool fed with the shallowest paths
+					while (stack.size() > 1 && pooled(seg) < (size_t) processes && push(seg, stack.front()))
+						stack.pop_front();
+					if (pending == COUNT_FLUSH) {
+						seg->nodes.fetch_add(pending, std::memory_order_relaxed);
+						pending = 0;
+					}
+					if (seg->stop.load(std::memory_order_relaxed))
+						return;
+				}
+
+				int bound = seg->bound.load(std::memory_order_relaxed);
+				if (current.leaf()) {
+					current.add(0);
+					if (current.distance() < bound)
+						update_shortest(seg, current);
+				} else if (current.distance() < bound) {
+					for (int i=current.max()-1; i>0; i--) {
+						if (!current.contains(i)) {
+							current.add(i);
+							stack.push_back(current);
+							current.pop();
+						}
+					}
+				}
+			}
+			seg->busy --;
+		}
+		seg->nodes.fetch_add(pending, std::memory_order_relaxed);
+	}
+
+	// wait for the workers pids without blocking on any of them; on
+	// the first that does not exit cleanly, stop and kill the others.
+	// returns false if one failed
+	static bool reap(Segment* seg, std::vector<pid_t>& pids)
+	{
+		bool ok = true;
+		while (!pids.empty()) {
+			for (size_t i=0; i<pids.size(); ) {
+				int status;
+				pid_t pid = waitpid(pids[i], &status, WNOHANG);
+				if (pid == 0 || (pid < 0 && errno == EINTR)) {
+					i ++;
+					continue;
+				}
+				if (ok && (pid < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)) {
+					if (pid > 0 && WIFSIGNALED(status))
+						std::cerr << "worker " << pid << " killed by signal " << WTERMSIG(status) << '\n';
+					else
+						std::cerr << "worker " << pids[i] << " failed\n";
+					ok = false;
+					seg->stop = true;
+					for (size_t k=0; k<pids.size(); k++)
+						if (k != i)
+							kill(pids[k], SIGKILL);
+				}
+				pids.erase(pids.begin() + i);
+			}
+			if (!pids.empty())
+				std::this_thread::sleep_for(std::chrono::milliseconds(REAP_WAIT));
+		}
+		return ok;
+	}
+
+public:
+	// search the tree rooted at [0] with processes forked workers;
+	// leaves the best tour in shortest and returns the # of nodes
+	// explored, or -1 if the search failed (the reason on std::cerr)
+	static long solve(Graph* g, int processes, Path* shortest)
+	{
+		size_t size = sizeof(Segment) + CAPACITY * sizeof(Cell) + g->placement();
+		std::string name = "/tspcc-" + std::to_string(getpid());
+		int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+		if (fd < 0 || ftruncate(fd, size) < 0) {
+			std::cerr << "cannot create shared memory " << name << " (" << std::strerror(errno) << ")\n";
+			if (fd >= 0) {
+				close(fd);
+				shm_unlink(name.c_str());
+			}
+			return -1;
+		}
+		void* mem = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		// children inherit the mapping, the name is not needed anymore
+		close(fd);
+		shm_unlink(name.c_str());
+		if (mem == MAP_FAILED) {
+			std::cerr << "cannot map shared memory (" << std::strerror(errno) << ")\n";
+			return -1;
+		}
+
+		Segment* seg = new (mem) Segment();
+		seg->head = 0;
+		seg->tail = 0;
+		seg->bound = shortest->distance();
+		seg->busy = 0;
+		seg->nodes = 0;
+		seg->lock = false;
+		seg->stop = false;
+		seg->shortest.set(*shortest);
+		Cell* cells = seg->cells();
+		for (size_t i=0; i<CAPACITY; i++)
+			new (&cells[i].seq) std::atomic<size_t>(i);
+		g->place(seg->distances());
+
+		Path root(g);
+		root.add(0);
+		push(seg, root);
+
+		std::vector<pid_t> pids;
+		bool forked = true;
+		for (int i=0; i<processes; i++) {
+			pid_t pid = fork();
+			if (pid == 0) {
+				worker(seg, g, processes);
+				_exit(0);
+			}
+			if (pid < 0) {
+				std::cerr << "cannot fork (" << std::strerror(errno) << ")\n";
+				seg->stop = true;
+				forked = false;
+				break;
+			}
+			pids.push_back(pid);
+		}
+		bool ok = reap(seg, pids) && forked;
+
+		long nodes = -1;
+		if (ok) {
+			Path best(g);
+			seg->shortest.get(best);
+			shortest->copy(&best);
+			nodes = seg->nodes.load();
+		}
+		g->unplace();
+		munmap(mem, size);
+		return nodes;
+	}
+};
+
+#endif // _shared_hpp
@@ -0,0 +1,1855 @@
+//
+//  solver.hpp
+//
+//  The search as a library: a Solver takes a graph and Options
+//  (engine, threads, bounds, limits), runs one of the engines on it and
+//  returns the shortest tour with the statistics of the run, telling a
+//  callback of each shorter tour on the way. The exact engines take up
+//  to Path::MAX - 1 cities; the heuristic one, any number that fits in
+//  a Graph, without proving its tour optimal. tspcc is a client of it.
+//  The engines keep their state in one static struct, so a program
+//  runs one solve at a time: solves from several threads wait for each
+//  other. That state is the last solve's until the next one starts,
+//  whichever Solver runs it.
+//
+
+#ifndef _solver_hpp
+#define _solver_hpp
+
+#include "graph.hpp"
+#include "path.hpp"
+#include "tspfile.hpp"
+#include "queue.hpp"
+#include "ringqueue.hpp"
+#include "checkpoint.hpp"
+#include "table.hpp"
+#include "localsearch.hpp"
+#include "heldkarp.hpp"
+#include "candidates.hpp"
+#include "assignment.hpp"
+#include "prefix.hpp"
+#include "spill.hpp"
+#include "profile.hpp"
+#include "heuristic.hpp"
+
+#include <thread>
+#include <barrier>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <stop_token>
+#include <functional>
+#include <atomic>
+#include <string>
+#include <chrono>
+#include <climits>
+#include <unistd.h>
+#include <pthread.h>
+#ifdef NUMA
+#include <numa.h>
+#endif
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#define MAX_DEPTH 10
+#define RING_CAPACITY (1 << 16)
+#define DEQUEUE_BATCH 4
+#define STOP_CHECK 1024	// # of nodes between two looks at the budget
+#define SPILL_BATCH 4096	// # of paths per spill file
+#define ADAPTIVE_LOW 4		// queued entries per worker to stop keeping children
+#define ADAPTIVE_HIGH 32	// queued entries per worker to start keeping them
+#define DET_PREFIXES 16		// prefixes dealt per worker by the deterministic engine
+#define DET_ROUND 16384		// nodes per worker between two incumbent merges
+#define OMP_CUTOFF 4		// levels below the seeds given a task each by the OpenMP engine
+#define HEURISTIC_STALL 20	// kicks per city without a shorter tour before the heuristic stops
+#define HEURISTIC_STALL_MIN 10000	// and at least that many
+
+enum Verbosity {
+	VER_NONE = 0,
+	VER_GRAPH = 1,
+	VER_SHORTER = 2,
+	VER_BOUND = 4,
+	VER_ANALYSE = 8,
+	VER_COUNTERS = 16,
+};
+
+enum QueueKind {
+	QUEUE_MS,		// linked Michael-Scott queue
+	QUEUE_MSB,		// same, with exponential backoff
+	QUEUE_MST,		// same, with 64-bit tagged pointers
+	QUEUE_RING,		// bounded ring with overflow
+};
+
+enum FrontierKind {
+	FRONTIER_PATH,		// a whole Path per entry
+	FRONTIER_PREFIX,	// a Prefix per entry, sharing the parent's
+};
+
+enum EngineKind {
+	ENGINE_BFS,		// one shared frontier queue, a Path per node
+	ENGINE_DFS,		// a stack per worker, subtrees split off on demand
+	ENGINE_DET,		// prefixes dealt statically, incumbents merged in rounds
+	ENGINE_OMP,		// OpenMP tasks down to a cutoff, depth-first below
+	ENGINE_HEURISTIC,	// iterated local search, no optimality proof
+};
+
+enum StopReason {
+	STOP_NONE = 0,
+	STOP_TIME,		// --time-limit reached
+	STOP_NODES,		// --node-limit reached
+	STOP_CALLER,	// Solver::stop(), on SIGINT or SIGTERM in tspcc
+	STOP_STALL,		// the heuristic found no shorter tour for a while
+	STOP_SPILL,		// spilled paths could not be read back
+};
+
+static struct {
+	Path* shortest;
+	std::mutex shortestMutex;
+	std::atomic<int> bound;		// distance of shortest, read without the mutex
+	std::chrono::steady_clock::time_point start;
+	std::chrono::steady_clock::time_point foundAt;	// when shortest was found
+	Verbosity verbose;
+	std::atomic<int> active;	// # of workers holding a path
+	int threads;	// # of workers
+	bool pin;		// pin workers to cores
+	QueueKind queue;	// frontier queue implementation
+	EngineKind engine;	// search order
+	FrontierKind frontier;	// breadth-first frontier entries
+	Spill* spill;		// frontier overflow on disk, 0 for none
+	long memoryCap;		// frontier bytes kept in memory, 0 for no cap
+	const char* spillDir;	// where spill files go
+	long spillCap;		// # of queued entries above which children are spilled
+	std::atomic<long> queued;	// # of entries in the queue, kept only if countQueued
+	bool countQueued;	// spilling or adaptive
+	bool adaptive;		// children kept by their worker while the frontier is large
+	struct {
+		std::atomic<bool> local;	// children are kept, not queued
+		long low, high;		// queued entries to go shared below, local above
+		std::atomic<long> switches;	// # of mode changes
+	} granularity;
+	std::atomic<int> idle;		// # of workers finding the queue empty
+	std::atomic<int> hungry;	// # of depth-first workers without work
+	std::atomic<long> splits;	// # of subtrees handed to hungry workers
+	std::atomic<int> openBound;	// over the stacks left when stopped
+	std::atomic<long> nodes;	// # of paths expanded, flushed every STOP_CHECK
+	std::atomic<int> stop;		// StopReason, set once by the first worker to see it
+	std::stop_source cancel;	// requested along with stop, watched by the workers
+	std::mutex cancelMutex;		// cancel is replaced between solves while stop() may run
+	long nodeLimit;		// 0 for no limit
+	double timeLimit;	// seconds, 0 for no limit
+	std::chrono::steady_clock::time_point deadline;
+	int lowerBound;		// over the frontier left when stopped
+	std::atomic<bool> pause;	// workers park while a checkpoint is taken
+	std::atomic<int> parked;	// # of workers parked
+	std::atomic<bool> snapshot;	// entries dequeued are saved for a checkpoint
+	std::atomic<int> saving;	// # of workers that may be saving a batch
+	struct Saved {
+		std::string paths;	// as Checkpoint::append writes them
+		long count;
+	};
+	std::vector<Saved> saved;	// by each worker, for the checkpoint under way
+	std::atomic<int> finished;	// # of workers done
+	const char* checkpoint;		// checkpoint file, 0 for none
+	double checkpointInterval;	// seconds between checkpoints
+	TranspositionTable* table;	// dominance pruning, 0 for none
+	struct {
+		std::atomic<long> probes;	// # of paths looked up
+		std::atomic<long> hits;		// # of paths found
+		std::atomic<long> pruned;	// # of paths dominated
+	} tt;
+	HeldKarp* heldKarp;	// penalised 1-tree bound, 0 for path length only
+	Candidates* candidates;	// edges left after reduced-cost elimination, 0 for all
+	Assignment* assignment;	// assignment bound on the graph, 0 for none
+	Heuristic* heuristic;	// the heuristic engine's tours, 0 for the exact ones
+	bool improve;		// local search on new incumbents
+	std::function<void(const std::vector<int>&, int, double)> incumbent;	// told of each shorter tour
+	struct {
+		std::mutex mutex;
+		std::condition_variable_any cv;
+		std::vector<int> tour;	// latest incumbent, not yet improved
+		bool pending;
+		long published;		// # of improved tours made incumbent
+	} improver;
+	struct WorkerStats {
+		double busy, idle;	// seconds
+		long nodes;
+		long dequeues, enqueues;	// # of bulk queue operations
+		long kept;		// # of children kept local
+	};
+	std::vector<WorkerStats> workers;
+} global;
+
+
+// create a mutex to print to the console
+inline std::mutex printMutex;
+// create a function to print to the console
+inline void print(const std::string& message, Path *path = nullptr)
+{
+	std::lock_guard<std::mutex> guard(printMutex);
+    if (path != nullptr)
+		std::cout << message << path << std::endl;
+	else
+		std::cout << message << std::endl;
+}
+
+// record current as the shortest tour if it still is,
+// and hand it to the improver unless it comes from there;
+// returns true if current became the shortest
+static bool update_shortest(Path* current, bool improve = true)
+{
+	{
+		std::lock_guard<std::mutex> guard(global.shortestMutex);
+		if (current->distance() >= global.shortest->distance())
+			return false;
+		global.shortest->copy(current);
+		global.bound.store(current->distance(), std::memory_order_relaxed);
+		global.foundAt = std::chrono::steady_clock::now();
+		if (global.incumbent) {
+			std::chrono::duration<double> secs = global.foundAt - global.start;
+			std::vector<int> tour;
+			for (int i=0; i<current->size(); i++)
+				tour.push_back(current->node(i));
+			global.incumbent(tour, current->distance(), secs.count());
+		}
+	}
+	if (global.improve && improve) {
+		std::lock_guard<std::mutex> guard(global.improver.mutex);
+		global.improver.tour = LocalSearch::tour(current);
+		global.improver.pending = true;
+		global.improver.cv.notify_one();
+	}
+	return true;
+}
+
+// runs 2-opt and Or-opt on each new incumbent, publishing
+// the result when it is strictly shorter than the bound by then
+static void improver(std::stop_token stop, Graph* g)
+{
+	std::unique_lock<std::mutex> lock(global.improver.mutex);
+	while (global.improver.cv.wait(lock, stop, [] { return global.improver.pending; })) {
+		std::vector<int> tour = global.improver.tour;
+		global.improver.pending = false;
+		lock.unlock();
+
+		LocalSearch::improve(g, tour);
+		if (LocalSearch::length(g, tour) < global.bound.load()) {
+			Path p(g);
+			LocalSearch::path(tour, &p);
+			if (update_shortest(&p, false))
+				global.improver.published ++;
+		}
+		lock.lock();
+	}
+}
+
+// stop all workers, for reason unless they are stopping already
+static void request_stop(StopReason reason)
+{
+	int none = STOP_NONE;
+	global.stop.compare_exchange_strong(none, reason);
+	std::lock_guard<std::mutex> guard(global.cancelMutex);
+	global.cancel.request_stop();
+}
+
+// flush the nodes counted since the last call, and stop all
+// workers if a budget is exhausted; returns true when stopping
+static bool check_budget(long& pending)
+{
+	long nodes = global.nodes.fetch_add(pending, std::memory_order_relaxed) + pending;
+	pending = 0;
+	if (global.nodeLimit && nodes >= global.nodeLimit)
+		request_stop(STOP_NODES);
+	else if (global.timeLimit > 0 && std::chrono::steady_clock::now() >= global.deadline)
+		request_stop(STOP_TIME);
+	return global.cancel.stop_requested();
+}
+
+
+// lower bound on any tour extending current; the assignment solved
+// for it is left in ap, if given, to bound its children
+static int lower_bound(Path* current, Assignment* ap = 0)
+{
+	Profile::Scope zone(Profile::BOUND);
+	int bound = current->distance();
+	if (global.heldKarp)
+		bound = std::max(bound, global.heldKarp->bound(current));
+	if (global.assignment) {
+		Assignment local(*global.assignment);
+		bound = std::max(bound, (ap ? ap : &local)->solve(current));
+	}
+	return bound;
+}
+
+// lower bound on child, one city longer than the path of ap
+static int child_bound(Path* child, const Assignment* ap)
+{
+	Profile::Scope zone(Profile::BOUND);
+	int bound = global.heldKarp ? global.heldKarp->bound(child) : child->distance();
+	if (global.assignment)
+		bound = std::max(bound, ap->extend(child));
+	return bound;
+}
+
+// per worker transposition table counters, flushed into global.tt
+static thread_local struct {
+	long probes;
+	long hits;
+	long pruned;
+} tt;
+
+// true if the table knows a shorter path through the same cities
+// to the same last city
+static bool dominated(Path* current)
+{
+	if (!global.table || current->size() < 3)
+		return false;
+	tt.probes ++;
+	TranspositionTable::Result res = global.table->check(current);
+	if (res == TranspositionTable::MISS)
+		return false;
+	tt.hits ++;
+	if (res == TranspositionTable::IMPROVED)
+		return false;
+	tt.pruned ++;
+	if (global.verbose & VER_BOUND)
+		print("dominated ", current);
+	return true;
+}
+
+// # of children of a path ending at city last, in branching order:
+// the candidate edges of last when there are some, else all cities
+static int children(int last, int max)
+{
+	return global.candidates ? global.candidates->degree(last) : max - 1;
+}
+
+// k-th child of a path ending at city last
+static int child(int last, int k)
+{
+	return global.candidates ? global.candidates->next(last, k) : k + 1;
+}
+
+// true if leaf, a path through all cities, may be closed back to 0
+static bool closes(Path* leaf)
+{
+	return !global.candidates || global.candidates->allowed(leaf->node(leaf->size() - 1), 0);
+}
+
+// close leaf if it is shorter than the incumbent
+static void close(Path& leaf)
+{
+	if (!closes(&leaf))
+		return;
+	leaf.add(0);
+	if (leaf.distance() < global.bound.load(std::memory_order_relaxed))
+		update_shortest(&leaf);
+	leaf.pop();
+}
+
+// breadth-first frontier entries are Path* or Prefix*
+
+// the path of entry e, rebuilt into scratch for a prefix
+static Path* open(Path* e, Path&) { return e; }
+static Path* open(Prefix* e, Path& scratch) { e->path(&scratch); return &scratch; }
+
+// distance of the path of e
+static int distance(Path* e) { return e->distance(); }
+static int distance(Prefix* e) { return e->distance(); }
+
+// entry for child, the path of the entry parent and one more city
+static Path* branch(Path*, Path* child)
+{
+	Profile::Scope zone(Profile::ALLOC);
+	return new Path(*child);
+}
+
+static Prefix* branch(Prefix* parent, Path* child)
+{
+	Profile::Scope zone(Profile::ALLOC);
+	return Prefix::child(parent, child);
+}
+
+static void drop(Path* e)
+{
+	Profile::Scope zone(Profile::ALLOC);
+	delete e;
+}
+
+static void drop(Prefix* e)
+{
+	Profile::Scope zone(Profile::ALLOC);
+	Prefix::release(e);
+}
+
+// entry for a whole path, taking it over
+static void wrap(Path* p, Path*& e) { e = p; }
+static void wrap(Path* p, Prefix*& e) { e = Prefix::chain(p); delete p; }
+
+// same for a batch of paths; consecutive prefixes share what they can
+static void wrap(std::vector<Path*>& paths, std::vector<Path*>& entries) { entries = paths; }
+static void wrap(std::vector<Path*>& paths, std::vector<Prefix*>& entries)
+{
+	for (size_t i=0; i<paths.size(); i++) {
+		int shared = 0;
+		if (i > 0)
+			while (shared < paths[i]->size() - 1 && shared < paths[i - 1]->size()
+					&& paths[i]->node(shared) == paths[i - 1]->node(shared))
+				shared ++;
+		entries.push_back(Prefix::chain(paths[i], i > 0 ? entries[i - 1] : nullptr, shared));
+		if (i > 0)
+			delete paths[i - 1];
+	}
+	if (!paths.empty())
+		delete paths.back();
+}
+
+// queued behind the frontier a checkpoint saves, never opened
+template <class E>
+static E sentinel()
+{
+	static char mark;
+	return reinterpret_cast<E>(&mark);
+}
+
+// save for worker id the paths of the n entries of batch up to the
+// sentinel, which ends the checkpoint and is taken out; returns the
+// entries left
+template <class E>
+static int save(int id, E* batch, int n, Path& scratch)
+{
+	for (int i=0; i<n; i++) {
+		if (batch[i] == sentinel<E>()) {
+			global.snapshot = false;
+			std::copy(batch + i + 1, batch + n, batch + i);
+			return n - 1;
+		}
+		Checkpoint::append(global.saved[id].paths, open(batch[i], scratch));
+		global.saved[id].count ++;
+	}
+	return n;
+}
+
+// per worker queue and idle counters, flushed into global.workers
+static thread_local struct {
+	long dequeues;
+	long enqueues;
+	long kept;
+} work;
+
+// whether expanded children stay with their worker, depth-first,
+// rather than being queued: only while nobody waits for work and the
+// queue is long, with some slack both ways so the mode does not flap
+static bool keep_local()
+{
+	bool local = global.granularity.local.load(std::memory_order_relaxed);
+	long queued = global.queued.load(std::memory_order_relaxed);
+	int idle = global.idle.load(std::memory_order_relaxed);
+	bool next = local ? (idle == 0 && queued >= global.granularity.low)
+		: (idle == 0 && queued >= global.granularity.high);
+	if (next != local && global.granularity.local.compare_exchange_strong(local, next))
+		global.granularity.switches ++;
+	return next;
+}
+
+// queue the children a worker kept
+template <class Q, class E>
+static void share(Q* queue, std::vector<E>& local)
+{
+	if (local.empty())
+		return;
+	Profile::Scope zone(Profile::QUEUE);
+	queue->enqueue_bulk(local.begin(), local.end());
+	global.queued.fetch_add(local.size(), std::memory_order_relaxed);
+	work.enqueues ++;
+	local.clear();
+}
+
+// check one path, queueing its children in one bulk operation, or
+// pushing them on local in adaptive mode; e is the frontier entry of
+// current
+template <class Q, class E>
+static void expand(Path* current, E e, Q* queue, std::vector<E>& local)
+{
+	Profile::Scope zone(Profile::BRANCH);
+	if (global.verbose & VER_ANALYSE)
+		print("analysing ", current);
+
+	if (current->leaf()) {
+		// this is a leaf
+		current->add(0);
+		if (current->distance() < global.bound.load(std::memory_order_relaxed))
+			update_shortest(current);
+		current->pop();
+	} else {
+		// not yet a leaf
+		int bound = global.bound.load(std::memory_order_relaxed);
+		bool bounded = global.heldKarp || global.assignment;
+		Assignment ap;
+		if (global.assignment)
+			ap = *global.assignment;
+		if (lower_bound(current, &ap) < bound && !dominated(current)) {
+			// continue branching, leaving out children bounded already
+			int last = current->node(current->size() - 1);
+			int m = children(last, current->max());
+			E batch[Path::MAX];
+			int n = 0;
+			bool keep = global.adaptive && keep_local();
+			// past the memory cap, children go to disk instead
+			bool spilling = !keep && global.spill
+				&& global.queued.load(std::memory_order_relaxed) >= global.spillCap;
+			for (int k=0; k<m; k++) {
+				int i = child(last, k);
+				if (!current->contains(i)) {
+					current->add(i);
+					if (current->leaf())
+						close(*current);
+					else if (!bounded || child_bound(current, &ap) < bound) {
+						if (spilling)
+							global.spill->put(current);
+						else
+							batch[n ++] = branch(e, current);
+					}
+					current->pop();
+				}
+			}
+			if (keep) {
+				// the nearest child on top
+				for (int j=n-1; j>=0; j--)
+					local.push_back(batch[j]);
+				work.kept += n;
+			} else {
+				Profile::Scope zone(Profile::QUEUE);
+				queue->enqueue_bulk(batch, batch + n);
+				work.enqueues ++;
+				if (global.countQueued)
+					global.queued.fetch_add(n, std::memory_order_relaxed);
+			}
+		}
+	}
+}
+
+// queue the oldest batch of spilled paths, if it is in memory or wait
+// is set; returns false if nothing was queued
+template <class Q>
+static bool reload(Graph* g, Q* queue, bool wait)
+{
+	std::vector<Path*> paths;
+	if (!global.spill->take(g, paths, wait)) {
+		// the rest of the tree is lost: stop with the tour found so far
+		if (global.spill->failed())
+			request_stop(STOP_SPILL);
+		return false;
+	}
+	std::vector<typename Q::value_type> entries;
+	wrap(paths, entries);
+	queue->enqueue_bulk(entries.begin(), entries.end());
+	global.queued.fetch_add(entries.size(), std::memory_order_relaxed);
+	return true;
+}
+
+// Q is the frontier queue: Queue or RingQueue; id is the worker's
+template <class Q>
+static void threaded_branch_and_bound(std::stop_token stop, int id, Graph* g, Q* queue)
+{
+	typedef typename Q::value_type E;
+	E batch[DEQUEUE_BATCH];
+	std::vector<E> local;	// children kept in adaptive mode
+	Path scratch(g);
+	long pending = 0, nodes = 0;
+	long task = -1;		// nodes when the last batch was dequeued
+	auto start = std::chrono::steady_clock::now();
+	auto idleSince = start;
+	bool idle = false;
+	std::chrono::duration<double> idleTime(0);
+	while (!stop.stop_requested()) {
+		if (global.pause.load(std::memory_order_relaxed)) {
+			// holding no path, the frontier is all in the queue, and
+			// all nodes expanded so far are counted
+			share(queue, local);
+			global.nodes.fetch_add(pending, std::memory_order_relaxed);
+			pending = 0;
+			global.parked ++;
+			while (global.pause.load())
+				std::this_thread::yield();
+			global.parked --;
+			continue;
+		}
+		// announce ourselves busy before polling, so that a worker
+		// finding the queue empty and nobody busy can safely leave
+		global.active ++;
+		int n;
+		if (!local.empty() && keep_local()) {
+			batch[0] = local.back();
+			local.pop_back();
+			n = 1;
+		} else {
+			// the frontier ran low or someone is idle: hand our subtrees out
+			share(queue, local);
+			Profile::Scope zone(Profile::QUEUE);
+			// whatever is dequeued before the sentinel belongs to the
+			// checkpoint under way, if any
+			bool saving = false;
+			if (global.checkpoint) {
+				global.saving ++;
+				saving = global.snapshot.load();
+				if (!saving)
+					global.saving --;
+			}
+			n = queue->dequeue_bulk(batch, DEQUEUE_BATCH);
+			if (saving) {
+				n = save(id, batch, n, scratch);
+				global.saving --;
+			}
+			work.dequeues ++;
+			if (global.countQueued)
+				global.queued.fetch_sub(n, std::memory_order_relaxed);
+			if (n > 0) {
+				if (task >= 0)
+					Profile::task(nodes - task);
+				task = nodes;
+			}
+		}
+		if (global.spill) {
+			// whoever reloads stays busy and polls again, so the spilled
+			// paths are never left behind by the last worker leaving
+			if (n == 0 && reload(g, queue, true)) {
+				global.active --;
+				continue;
+			}
+			if (n > 0 && global.queued.load(std::memory_order_relaxed) < global.spillCap / 2)
+				reload(g, queue, false);
+		}
+		if (n == 0) {
+			if (!idle) {
+				idle = true;
+				idleSince = std::chrono::steady_clock::now();
+				global.idle ++;
+			}
+			if (-- global.active == 0)
+				break;
+			Profile::Scope zone(Profile::IDLE);
+			std::this_thread::yield();
+			continue;
+		}
+		if (idle) {
+			idle = false;
+			std::chrono::duration<double> spell = std::chrono::steady_clock::now() - idleSince;
+			idleTime += spell;
+			Profile::idle(spell.count());
+			global.idle --;
+		}
+
+		for (int i=0; i<n; i++) {
+			// a prefix is only rebuilt if it may still lead somewhere
+			if (distance(batch[i]) < global.bound.load(std::memory_order_relaxed))
+				expand(open(batch[i], scratch), batch[i], queue, local);
+			drop(batch[i]);
+			nodes ++;
+			if (++ pending == STOP_CHECK && check_budget(pending)) {
+				// leave the rest of the batch to the frontier
+				queue->enqueue_bulk(batch + i + 1, batch + n);
+				if (global.countQueued)
+					global.queued.fetch_add(n - i - 1, std::memory_order_relaxed);
+				break;
+			}
+		}
+		global.active --;
+	}
+	share(queue, local);
+	if (task >= 0)
+		Profile::task(nodes - task);
+	auto end = std::chrono::steady_clock::now();
+	if (idle) {
+		idleTime += end - idleSince;
+		global.idle --;
+	}
+	std::chrono::duration<double> total = end - start;
+	global.workers[id] = { total.count() - idleTime.count(), idleTime.count(), nodes,
+		work.dequeues, work.enqueues, work.kept };
+	global.nodes.fetch_add(pending, std::memory_order_relaxed);
+	global.tt.probes += tt.probes;
+	global.tt.hits += tt.hits;
+	global.tt.pruned += tt.pruned;
+	global.finished ++;
+}
+
+// keep the memory of worker id on its NUMA node and, if pinning,
+// the worker on a core of that node; called by the worker itself
+static void place_worker(int id)
+{
+	int ncpus = std::thread::hardware_concurrency();
+	if (ncpus < 1)
+		ncpus = 1;
+	int cpu = id % ncpus;
+
+#ifdef NUMA
+	// paths and queue nodes are allocated by the worker creating them,
+	// so keep them on the node the worker runs on
+	if (numa_available() >= 0) {
+		numa_set_localalloc();
+		if (global.pin) {
+			int node = numa_node_of_cpu(cpu);
+			if (node >= 0)
+				numa_run_on_node(node);
+		}
+	}
+#endif
+	if (!global.pin)
+		return;
+	// last, since binding to a node widens the affinity to all its cores
+#ifdef __linux__
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	if (err)
+		std::cerr << "cannot pin worker " << id << " to cpu " << cpu << " (" << std::strerror(err) << ")\n";
+#endif
+	if (global.verbose & VER_COUNTERS)
+		print("worker " + std::to_string(id) + " on cpu " + std::to_string(cpu));
+}
+
+template <class Q>
+static void worker(std::stop_token stop, int id, Graph* g, Q* queue)
+{
+	place_worker(id);
+	threaded_branch_and_bound(stop, id, g, queue);
+}
+
+// empty the queue into frontier, but for a checkpoint's sentinel
+template <class Q, class E>
+static void drain(Q* queue, std::vector<E>& frontier)
+{
+	E chunk[64];
+	int n;
+	while ((n = queue->dequeue_bulk(chunk, 64)) > 0)
+		for (int i=0; i<n; i++)
+			if (chunk[i] != sentinel<E>())
+				frontier.push_back(chunk[i]);
+}
+
+// encode the incumbent, nodes and frontier
+static std::string encode_checkpoint(Graph* g, long nodes, const std::vector<Path*>& frontier)
+{
+	std::lock_guard<std::mutex> guard(global.shortestMutex);
+	return Checkpoint::encode(g, global.shortest, nodes, frontier);
+}
+
+static std::string encode_checkpoint(Graph* g, long nodes, const std::vector<Prefix*>& frontier)
+{
+	std::vector<Path> paths(frontier.size(), Path(g));
+	std::vector<Path*> ptrs;
+	for (size_t i=0; i<frontier.size(); i++) {
+		frontier[i]->path(&paths[i]);
+		ptrs.push_back(&paths[i]);
+	}
+	return encode_checkpoint(g, nodes, ptrs);
+}
+
+// write buf to global.checkpoint, reporting how long the workers were
+// paused for it and how long the write itself took
+static void write_checkpoint(const std::string& buf, size_t paths, double paused)
+{
+	auto start = std::chrono::steady_clock::now();
+	if (!Checkpoint::write(global.checkpoint, buf)) {
+		std::cerr << "cannot write checkpoint " << global.checkpoint << " (" << std::strerror(errno) << ")\n";
+		return;
+	}
+	std::chrono::duration<double, std::milli> writing = std::chrono::steady_clock::now() - start;
+	print("checkpoint: " + std::to_string(paths) + " paths, " + std::to_string(buf.size()) + " bytes, "
+		+ std::to_string(paused) + " ms paused, " + std::to_string(writing.count()) + " ms writing");
+}
+
+// park the workers just long enough to count their nodes and queue a
+// sentinel behind the frontier. what is dequeued before the sentinel is
+// the frontier of that moment (and, at worst, a few of its descendants
+// twice): the workers save what they dequeue of it, and so do we,
+// queueing it again behind the sentinel. then write that out
+template <class Q>
+static void take_checkpoint(Graph* g, Q* queue)
+{
+	typedef typename Q::value_type E;
+	global.pause = true;
+	while (global.parked + global.finished < global.threads)
+		std::this_thread::yield();
+
+	auto start = std::chrono::steady_clock::now();
+	long nodes = global.nodes.load();
+	global.saved.assign(global.threads + 1, {});
+	global.snapshot = true;
+	queue->enqueue(sentinel<E>());
+	global.pause = false;
+	std::chrono::duration<double, std::milli> paused = std::chrono::steady_clock::now() - start;
+
+	E batch[DEQUEUE_BATCH];
+	Path scratch(g);
+	while (global.snapshot && global.finished < global.threads) {
+		// busy while holding entries, so that no worker leaves meanwhile
+		global.active ++;
+		int n = queue->dequeue_bulk(batch, DEQUEUE_BATCH);
+		n = save(global.threads, batch, n, scratch);
+		queue->enqueue_bulk(batch, batch + n);
+		global.active --;
+		if (n == 0)
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	// if the search ended first, the last checkpoint is taken then
+	bool complete = !global.snapshot;
+	global.snapshot = false;
+	while (global.saving > 0)
+		std::this_thread::yield();
+	if (!complete) {
+		global.saved.clear();
+		return;
+	}
+
+	uint64_t count = 0;
+	std::vector<std::string> pieces;
+	for (auto& s : global.saved) {
+		count += s.count;
+		pieces.push_back(std::move(s.paths));
+	}
+	global.saved.clear();
+	std::string buf;
+	{
+		std::lock_guard<std::mutex> guard(global.shortestMutex);
+		buf = Checkpoint::encode(g, global.shortest, nodes, count, pieces);
+	}
+	write_checkpoint(buf, count, paused.count());
+}
+
+// a ring is not FIFO once values overflow, so that values queued after
+// the sentinel could come out before it: park the workers for the whole
+// snapshot instead, then write it out
+template <class E>
+static void take_checkpoint(Graph* g, RingQueue<E>* queue)
+{
+	global.pause = true;
+	while (global.parked + global.finished < global.threads)
+		std::this_thread::yield();
+
+	auto start = std::chrono::steady_clock::now();
+	std::vector<E> frontier;
+	drain(queue, frontier);
+	std::string buf = encode_checkpoint(g, global.nodes.load(), frontier);
+	queue->enqueue_bulk(frontier.begin(), frontier.end());
+	global.pause = false;
+	std::chrono::duration<double, std::milli> paused = std::chrono::steady_clock::now() - start;
+
+	write_checkpoint(buf, frontier.size(), paused.count());
+}
+
+// start the improver on the current incumbent, if asked to
+static std::jthread start_improver(Graph* g)
+{
+	if (!global.improve)
+		return std::jthread();
+	std::jthread th(improver, g);
+	std::lock_guard<std::mutex> guard(global.improver.mutex);
+	global.improver.tour = LocalSearch::tour(global.shortest);
+	global.improver.pending = true;
+	global.improver.cv.notify_one();
+	return th;
+}
+
+static void stop_improver(std::jthread& th)
+{
+	if (!th.joinable())
+		return;
+	th.request_stop();
+	th.join();
+}
+
+// busy and idle time and queue operations of each worker, and how far
+// the busiest one is from the mean
+static void print_workers()
+{
+	double busy = 0, most = 0;
+	for (size_t i=0; i<global.workers.size(); i++) {
+		const auto& w = global.workers[i];
+		std::cout << "worker " << i << ": busy " << w.busy << "s, idle " << w.idle << "s, "
+			<< w.nodes << " nodes, " << w.dequeues << " dequeues, " << w.enqueues << " enqueues, "
+			<< w.kept << " kept\n";
+		busy += w.busy;
+		most = std::max(most, w.busy);
+	}
+	double mean = busy / global.workers.size();
+	std::cout << "imbalance " << (mean > 0 ? most / mean : 1) << " (busiest over mean busy time)";
+	if (global.adaptive)
+		std::cout << ", " << global.granularity.switches.load() << " granularity switches";
+	std::cout << '\n';
+}
+
+// explore the tree from the seed paths with global.threads workers
+template <class Q>
+static void solve(Graph* g, Q* queue, std::vector<Path*>& seeds)
+{
+	typedef typename Q::value_type E;
+	int seedBound = INT_MAX;	// holds whatever is lost
+	for (Path* p : seeds) {
+		seedBound = std::min(seedBound, lower_bound(p));
+		E e;
+		wrap(p, e);
+		queue->enqueue(e);
+	}
+	global.queued = seeds.size();
+	global.workers.assign(global.threads, {});
+
+	std::jthread improving = start_improver(g);
+
+	std::vector<std::jthread> threads;
+	for (int i = 0; i < global.threads; i++) {
+		threads.push_back(std::jthread(worker<Q>, global.cancel.get_token(), i, g, queue));
+	}
+
+	if (global.checkpoint) {
+		auto last = std::chrono::steady_clock::now();
+		std::chrono::duration<double> interval(global.checkpointInterval);
+		while (global.finished < global.threads) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+			if (std::chrono::steady_clock::now() - last >= interval) {
+				take_checkpoint(g, queue);
+				last = std::chrono::steady_clock::now();
+			}
+		}
+	}
+
+	for (auto &th : threads)
+		th.join();
+	stop_improver(improving);
+
+	// when stopped early, what is left in the frontier bounds the optimum
+	std::vector<E> frontier;
+	drain(queue, frontier);
+	global.lowerBound = global.shortest->distance();
+	Path scratch(g);
+	for (E e : frontier) {
+		int bound = lower_bound(open(e, scratch));
+		if (bound < global.lowerBound)
+			global.lowerBound = bound;
+	}
+	std::vector<Path*> spilled;
+	while (global.spill && global.spill->take(g, spilled, true)) {
+		for (Path* p : spilled) {
+			global.lowerBound = std::min(global.lowerBound, lower_bound(p));
+			delete p;
+		}
+		spilled.clear();
+	}
+	if (global.spill && global.spill->failed())
+		global.lowerBound = std::min(global.lowerBound, seedBound);
+	if (global.checkpoint && global.cancel.stop_requested())
+		write_checkpoint(encode_checkpoint(g, global.nodes.load(), frontier), frontier.size(), 0);
+	for (E e : frontier)
+		drop(e);
+}
+
+// memory taken by a queued entry, queue node included
+static size_t footprint(Path*) { return sizeof(Path) + 2 * sizeof(void*); }
+static size_t footprint(Prefix*) { return sizeof(Prefix) + 2 * sizeof(void*); }
+
+// explore the tree breadth-first with the queue and entries asked for
+template <class E>
+static void solve_breadth_first(Graph* g, std::vector<Path*>& seeds)
+{
+	if (global.memoryCap) {
+		global.spillCap = std::max<long>(global.memoryCap / footprint(E()), 2 * SPILL_BATCH);
+		global.spill = new Spill(global.spillDir, SPILL_BATCH);
+	}
+	global.countQueued = global.spill || global.adaptive;
+	global.granularity.low = ADAPTIVE_LOW * global.threads;
+	global.granularity.high = ADAPTIVE_HIGH * global.threads;
+	if (global.queue == QUEUE_RING) {
+		RingQueue<E> queue(RING_CAPACITY);
+		solve(g, &queue, seeds);
+		if (global.verbose & VER_COUNTERS)
+			std::cout << "ring overflowed: " << queue.overflowed() << '\n';
+	} else if (global.queue == QUEUE_MST) {
+		Queue<E, NoBackoff, AtomicTagged> queue;
+		solve(g, &queue, seeds);
+	} else if (global.queue == QUEUE_MSB) {
+		Queue<E, ExpBackoff<> > queue;
+		solve(g, &queue, seeds);
+	} else {
+		Queue<E> queue;
+		solve(g, &queue, seeds);
+	}
+	if (global.verbose & VER_COUNTERS)
+		print_workers();
+	if (global.spill && (global.verbose & VER_COUNTERS))
+		std::cout << "spilled: " << global.spill->written() << " batches of " << SPILL_BATCH << " paths\n";
+	delete global.spill;
+	global.spill = 0;
+}
+
+// a subtree for the depth-first engine: the children first..last-1,
+// in branching order, of path
+struct Task {
+	Path* path;
+	int first, last;
+};
+
+// one level of a depth-first worker's stack
+struct Frame {
+	int next, last;		// children of the path at this level still to try
+	Assignment ap;		// assignment solved for that path
+};
+
+// lower the bound over what stopped workers leave open to b
+static void open_bound(int b)
+{
+	int old = global.openBound.load();
+	while (b < old && !global.openBound.compare_exchange_weak(old, b))
+		;
+}
+
+// hand the second half of the untried children of the shallowest
+// level that has some to a hungry worker
+static void split(Graph* g, Path& path, Frame* stack, int top, int base, Queue<Task>* tasks)
+{
+	for (int t=0; t<=top; t++) {
+		int left = stack[t].last - stack[t].next;
+		if (left == 0)
+			continue;
+		Path* p = new Path(g);
+		for (int i=0; i<base+t; i++)
+			p->add(path.node(i));
+		int mid = stack[t].next + left / 2;
+		Profile::Scope zone(Profile::QUEUE);
+		tasks->enqueue(Task { p, mid, stack[t].last });
+		stack[t].last = mid;
+		global.splits ++;
+		return;
+	}
+}
+
+// depth-first search of the subtree of task over one mutable path,
+// with no allocation per node, splitting into tasks unless it is
+// null; returns false when stopped
+static bool depth_first(Graph* g, Task& task, Frame* stack, long& pending, Queue<Task>* tasks)
+{
+	Profile::Scope zone(Profile::BRANCH);
+	long explored = 0;
+	Path path(g);
+	path.copy(task.path);
+	delete task.path;
+	if (path.leaf()) {
+		close(path);
+		return true;
+	}
+	bool bounded = global.heldKarp || global.assignment;
+	int base = path.size();
+	int top = 0;
+	stack[0].next = task.first;
+	stack[0].last = task.last;
+	if (global.assignment) {
+		stack[0].ap = *global.assignment;
+		stack[0].ap.solve(&path);
+	}
+
+	while (top >= 0) {
+		Frame& f = stack[top];
+		if (f.next == f.last) {
+			if (top -- > 0)
+				path.pop();
+			continue;
+		}
+		int i = child(path.node(path.size() - 1), f.next ++);
+		if (path.contains(i))
+			continue;
+
+		explored ++;
+		if (++ pending == STOP_CHECK && check_budget(pending)) {
+			// what is left on the stack bounds the optimum
+			f.next --;
+			int low = INT_MAX;
+			for (; top >= 0; top--) {
+				int last = path.node(path.size() - 1);
+				for (int k=stack[top].next; k<stack[top].last; k++) {
+					if (path.contains(child(last, k)))
+						continue;
+					path.add(child(last, k));
+					low = std::min(low, lower_bound(&path));
+					path.pop();
+				}
+				if (top > 0)
+					path.pop();
+			}
+			open_bound(low);
+			Profile::task(explored);
+			return false;
+		}
+
+		path.add(i);
+		if (global.verbose & VER_ANALYSE)
+			print("analysing ", &path);
+		if (path.leaf()) {
+			close(path);
+			path.pop();
+			continue;
+		}
+		int bound = global.bound.load(std::memory_order_relaxed);
+		bool pruned = bounded ? child_bound(&path, &f.ap) >= bound : path.distance() >= bound;
+		if (pruned || dominated(&path)) {
+			path.pop();
+			continue;
+		}
+		Frame& c = stack[++ top];
+		c.next = 0;
+		c.last = children(i, path.max());
+		if (global.assignment) {
+			c.ap = f.ap;
+			c.ap.solve(&path);
+		}
+
+		if (tasks && global.hungry.load(std::memory_order_relaxed) > 0 && tasks->empty())
+			split(g, path, stack, top, base, tasks);
+	}
+	Profile::task(explored);
+	return true;
+}
+
+// a depth-first worker: takes subtrees from tasks until none is left
+// and nobody can split one off anymore
+static void depth_first_worker(std::stop_token stop, int id, Graph* g, Queue<Task>* tasks)
+{
+	place_worker(id);
+	Frame stack[Path::MAX];
+	long pending = 0;
+	bool idle = false;
+	auto idleSince = std::chrono::steady_clock::now();
+	while (!stop.stop_requested()) {
+		// same termination rule as the breadth-first workers
+		global.active ++;
+		Task task;
+		bool got;
+		{
+			Profile::Scope zone(Profile::QUEUE);
+			got = tasks->try_dequeue(task);
+		}
+		if (!got) {
+			if (!idle) {
+				idle = true;
+				idleSince = std::chrono::steady_clock::now();
+				global.hungry ++;
+			}
+			if (-- global.active == 0)
+				break;
+			Profile::Scope zone(Profile::IDLE);
+			std::this_thread::yield();
+			continue;
+		}
+		if (idle) {
+			idle = false;
+			std::chrono::duration<double> spell = std::chrono::steady_clock::now() - idleSince;
+			Profile::idle(spell.count());
+			global.hungry --;
+		}
+		bool done = depth_first(g, task, stack, pending, tasks);
+		global.active --;
+		if (!done)
+			break;
+	}
+	if (idle)
+		global.hungry --;
+	global.nodes.fetch_add(pending, std::memory_order_relaxed);
+	global.tt.probes += tt.probes;
+	global.tt.hits += tt.hits;
+	global.tt.pruned += tt.pruned;
+}
+
+// explore the tree from the seed paths depth-first with global.threads workers
+static void solve_depth_first(Graph* g, std::vector<Path*>& seeds)
+{
+	Queue<Task> tasks;
+	for (Path* p : seeds) {
+		// a resumed frontier may hold paths its incumbent has bounded since
+		if (p->leaf()) {
+			close(*p);
+			delete p;
+		} else if (lower_bound(p) >= global.bound.load() || dominated(p)) {
+			delete p;
+		} else {
+			tasks.enqueue(Task { p, 0, children(p->node(p->size() - 1), p->max()) });
+		}
+	}
+	global.tt.probes += tt.probes;
+	global.tt.hits += tt.hits;
+	global.tt.pruned += tt.pruned;
+	tt.probes = tt.hits = tt.pruned = 0;
+	global.openBound = INT_MAX;
+
+	std::jthread improving = start_improver(g);
+	std::vector<std::jthread> threads;
+	for (int i = 0; i < global.threads; i++) {
+		threads.push_back(std::jthread(depth_first_worker, global.cancel.get_token(), i, g, &tasks));
+	}
+	for (auto &th : threads)
+		th.join();
+	stop_improver(improving);
+
+	Task task;
+	while (tasks.try_dequeue(task)) {
+		open_bound(lower_bound(task.path));
+		delete task.path;
+	}
+	global.lowerBound = std::min(global.shortest->distance(), global.openBound.load());
+}
+
+// a deterministic worker's share of the tree: the prefixes dealt to
+// it, searched depth-first one after the other over path and stack
+struct Stream {
+	std::vector<Path*> prefixes;
+	size_t next;		// first prefix not started
+	Path path;
+	Frame stack[Path::MAX];
+	int top;			// -1 between two prefixes
+	Path best;			// shortest tour found in this round, if found
+	bool found;
+	bool done;			// no prefix and no stack left
+	long nodes;
+
+	Stream(Graph* g) : next(0), path(g), top(-1), best(g), found(false), done(false), nodes(0) {}
+};
+
+// close leaf if it is shorter than the round bound and what s found
+static void close(Path& leaf, Stream& s, int bound)
+{
+	if (!closes(&leaf))
+		return;
+	leaf.add(0);
+	if (leaf.distance() < (s.found ? s.best.distance() : bound)) {
+		s.best.copy(&leaf);
+		s.found = true;
+	}
+	leaf.pop();
+}
+
+// search s for budget nodes, or until it is done, pruning against the
+// bound of the round and whatever s finds in it: what a worker does
+// in a round does not depend on the others
+static void deterministic_round(Stream& s, int bound, long budget)
+{
+	Profile::Scope zone(Profile::BRANCH);
+	bool bounded = global.heldKarp || global.assignment;
+	long n = 0;
+	while (n < budget) {
+		int limit = s.found ? s.best.distance() : bound;
+		if (s.top < 0) {
+			if (s.next == s.prefixes.size()) {
+				s.done = true;
+				break;
+			}
+			Path* p = s.prefixes[s.next ++];
+			s.path.copy(p);
+			delete p;
+			Frame& f = s.stack[0];
+			if (global.assignment)
+				f.ap = *global.assignment;
+			if (lower_bound(&s.path, &f.ap) >= limit)
+				continue;
+			f.next = 0;
+			f.last = children(s.path.node(s.path.size() - 1), s.path.max());
+			s.top = 0;
+			continue;
+		}
+		Frame& f = s.stack[s.top];
+		if (f.next == f.last) {
+			if (s.top -- > 0)
+				s.path.pop();
+			continue;
+		}
+		int i = child(s.path.node(s.path.size() - 1), f.next ++);
+		if (s.path.contains(i))
+			continue;
+		n ++;
+		s.path.add(i);
+		if (global.verbose & VER_ANALYSE)
+			print("analysing ", &s.path);
+		if (s.path.leaf()) {
+			close(s.path, s, bound);
+			s.path.pop();
+			continue;
+		}
+		if (bounded ? child_bound(&s.path, &f.ap) >= limit : s.path.distance() >= limit) {
+			s.path.pop();
+			continue;
+		}
+		Frame& c = s.stack[++ s.top];
+		c.next = 0;
+		c.last = children(i, s.path.max());
+		if (global.assignment) {
+			c.ap = f.ap;
+			c.ap.solve(&s.path);
+		}
+	}
+	s.nodes += n;
+}
+
+// lowest bound over what s has left open
+static int left_open(Stream& s)
+{
+	int low = INT_MAX;
+	for (size_t i=s.next; i<s.prefixes.size(); i++) {
+		low = std::min(low, lower_bound(s.prefixes[i]));
+		delete s.prefixes[i];
+	}
+	for (; s.top >= 0; s.top--) {
+		int last = s.path.node(s.path.size() - 1);
+		for (int k=s.stack[s.top].next; k<s.stack[s.top].last; k++) {
+			if (s.path.contains(child(last, k)))
+				continue;
+			s.path.add(child(last, k));
+			low = std::min(low, lower_bound(&s.path));
+			s.path.pop();
+		}
+		if (s.top > 0)
+			s.path.pop();
+	}
+	return low;
+}
+
+// expand seeds level by level, in order, until there are want prefixes
+static std::vector<Path*> deal(std::vector<Path*>& seeds, size_t want)
+{
+	std::vector<Path*> level = seeds;
+	while (!level.empty() && level.size() < want) {
+		std::vector<Path*> next;
+		bool grown = false;
+		for (Path* p : level) {
+			if (p->leaf()) {
+				next.push_back(p);
+				continue;
+			}
+			grown = true;
+			global.nodes ++;
+			if (lower_bound(p) < global.bound.load()) {
+				int last = p->node(p->size() - 1);
+				int m = children(last, p->max());
+				for (int k=0; k<m; k++) {
+					int i = child(last, k);
+					if (p->contains(i))
+						continue;
+					Path* c = new Path(*p);
+					c->add(i);
+					if (c->leaf()) {
+						close(*c);
+						delete c;
+					} else {
+						next.push_back(c);
+					}
+				}
+			}
+			delete p;
+		}
+		level.swap(next);
+		if (!grown)
+			break;
+	}
+	return level;
+}
+
+// explore the tree from the seed paths with global.threads workers,
+// reproducibly: the same tour and node count for the same # of workers
+static void solve_deterministic(Graph* g, std::vector<Path*>& seeds)
+{
+	std::vector<Path*> prefixes = deal(seeds, DET_PREFIXES * global.threads);
+	std::vector<Stream> streams;
+	streams.reserve(global.threads);
+	for (int i=0; i<global.threads; i++)
+		streams.emplace_back(g);
+	for (size_t i=0; i<prefixes.size(); i++)
+		streams[i % global.threads].prefixes.push_back(prefixes[i]);
+
+	long base = global.nodes.load();
+	int bound = global.bound.load();
+	bool done = false;
+	auto merge = [&]() noexcept {
+		// in worker order, so that ties go to the same worker every time
+		long nodes = base;
+		done = true;
+		for (Stream& s : streams) {
+			if (s.found)
+				update_shortest(&s.best, false);
+			s.found = false;
+			done = done && s.done;
+			nodes += s.nodes;
+		}
+		bound = global.bound.load();
+		global.nodes = nodes;
+		// limits are only looked at here, so a node limit stops at the same place
+		if (global.nodeLimit && nodes >= global.nodeLimit)
+			request_stop(STOP_NODES);
+		else if (global.timeLimit > 0 && std::chrono::steady_clock::now() >= global.deadline)
+			request_stop(STOP_TIME);
+		if (global.cancel.stop_requested())
+			done = true;
+	};
+	std::barrier sync(global.threads, merge);
+
+	std::vector<std::jthread> threads;
+	for (int i = 0; i < global.threads; i++) {
+		threads.push_back(std::jthread([&, i] {
+			place_worker(i);
+			while (!done) {
+				deterministic_round(streams[i], bound, DET_ROUND);
+				Profile::Scope zone(Profile::IDLE);
+				sync.arrive_and_wait();
+			}
+		}));
+	}
+	for (auto &th : threads)
+		th.join();
+
+	int low = INT_MAX;
+	for (Stream& s : streams)
+		low = std::min(low, left_open(s));
+	global.lowerBound = std::min(global.shortest->distance(), low);
+}
+
+#ifdef _OPENMP
+// the OpenMP engine: a task per path down to cutoff cities, each
+// searching its subtree with depth_first below that, and the runtime
+// balancing the tasks by work stealing. the first worker out of budget
+// cancels the task group; tasks that still start (all of them unless
+// OMP_CANCELLATION=true) only add their bound to what is left open,
+// and solve_omp does it for those cancelled before they started
+
+static thread_local long ompPending;
+
+// a spawned task, kept by the thread spawning it
+struct OmpTask {
+	Path* path;		// owned by the task once it runs
+	bool ran;
+};
+static thread_local std::vector<OmpTask*> ompSpawned;
+
+static bool omp_search(Graph* g, Path* path, int cutoff);
+
+// spawn a task searching path
+static void omp_spawn(Graph* g, Path* path, int cutoff)
+{
+	OmpTask* t = new OmpTask { path, false };
+	ompSpawned.push_back(t);
+	#pragma omp task firstprivate(t)
+	{
+		t->ran = true;
+		if (!omp_search(g, t->path, cutoff)) {
+			#pragma omp cancel taskgroup
+		}
+	}
+}
+
+// returns false when out of budget
+static bool omp_search(Graph* g, Path* path, int cutoff)
+{
+	if (global.cancel.stop_requested()) {
+		open_bound(lower_bound(path));
+		delete path;
+		return true;
+	}
+	int last = path->node(path->size() - 1);
+	int m = children(last, path->max());
+	if (path->size() >= cutoff || path->leaf()) {
+		Frame stack[Path::MAX];
+		Task task { path, 0, m };
+		return depth_first(g, task, stack, ompPending, nullptr);
+	}
+	if (lower_bound(path) < global.bound.load(std::memory_order_relaxed)) {
+		for (int k=0; k<m; k++) {
+			int i = child(last, k);
+			if (path->contains(i))
+				continue;
+			Path* c = new Path(*path);
+			c->add(i);
+			if (++ ompPending == STOP_CHECK)
+				check_budget(ompPending);
+			if (c->leaf()) {
+				close(*c);
+				delete c;
+				continue;
+			}
+			omp_spawn(g, c, cutoff);
+		}
+	}
+	delete path;
+	return !global.cancel.stop_requested();
+}
+
+// explore the tree from the seed paths with OpenMP tasks on global.threads threads
+static void solve_omp(Graph* g, std::vector<Path*>& seeds)
+{
+	global.openBound = INT_MAX;
+	std::jthread improving = start_improver(g);
+	#pragma omp parallel num_threads(global.threads)
+	{
+		place_worker(omp_get_thread_num());
+		#pragma omp single
+		{
+			#pragma omp taskgroup
+			{
+				for (Path* p : seeds)
+					omp_spawn(g, p, p->size() + OMP_CUTOFF);
+			}
+		}
+		// all tasks are done or cancelled: the cancelled ones leave
+		// their paths open
+		for (OmpTask* t : ompSpawned) {
+			if (!t->ran) {
+				open_bound(lower_bound(t->path));
+				delete t->path;
+			}
+			delete t;
+		}
+		ompSpawned.clear();
+		global.nodes.fetch_add(ompPending, std::memory_order_relaxed);
+		ompPending = 0;
+		global.tt.probes += tt.probes;
+		global.tt.hits += tt.hits;
+		global.tt.pruned += tt.pruned;
+		tt.probes = tt.hits = tt.pruned = 0;
+	}
+	stop_improver(improving);
+	global.lowerBound = std::min(global.shortest->distance(), global.openBound.load());
+}
+#endif
+
+// the heuristic engine: global.threads workers kicking tours of their
+// own and sharing the best one, until it goes stale or a limit is
+// reached; nodes count kicks. the best tour is left in global.heuristic
+static void solve_heuristic(Graph* g)
+{
+	// given a time limit, all of it is used
+	long stall = std::max<long>((long) HEURISTIC_STALL * g->size(), HEURISTIC_STALL_MIN);
+	if (global.timeLimit > 0)
+		stall = LONG_MAX;
+	global.heuristic = new Heuristic(g, stall);
+	Heuristic::Improved improved = [](const std::vector<int>& tour, int length) {
+		global.bound = length;
+		global.foundAt = std::chrono::steady_clock::now();
+		if (global.incumbent) {
+			std::chrono::duration<double> secs = global.foundAt - global.start;
+			global.incumbent(tour, length, secs.count());
+		}
+	};
+	Heuristic::Going going = [](long kicks) { return !check_budget(kicks); };
+
+	std::vector<std::jthread> threads;
+	for (int i = 0; i < global.threads; i++) {
+		threads.push_back(std::jthread([&, i] {
+			place_worker(i);
+			global.heuristic->search(i + 1, going, improved);
+		}));
+	}
+	for (auto &th : threads)
+		th.join();
+
+	int none = STOP_NONE;
+	global.stop.compare_exchange_strong(none, STOP_STALL);
+	global.lowerBound = global.heuristic->one_tree();
+}
+
+class Solver {
+public:
+	struct Options {
+		int threads = std::thread::hardware_concurrency();
+		EngineKind engine = ENGINE_BFS;
+		QueueKind queue = QUEUE_MS;			// breadth-first frontier queue
+		FrontierKind frontier = FRONTIER_PATH;
+		bool pin = false;			// workers to cores
+		bool adaptive = false;		// children kept local while the frontier is long
+		long memory = 0;			// frontier bytes kept in memory, 0 for no cap
+		std::string spillDir = getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp";
+		double timeLimit = 0;		// seconds, 0 for no limit
+		long nodeLimit = 0;			// 0 for no limit
+		std::string checkpoint;		// breadth-first checkpoint file, empty for none
+		double checkpointInterval = 60;	// seconds
+		double tt = 0;				// transposition table megabytes, 0 for none
+		bool improve = false;		// local search on new incumbents
+		int heldKarp = -1;			// subgradient iterations, -1 for no Held-Karp bound
+		bool eliminate = false;		// reduced-cost elimination, needs heldKarp
+		bool assignment = false;	// assignment bound
+		Verbosity verbose = VER_NONE;	// what the engines print along the way
+		// called with each shorter tour (closed, from city 0 back to
+		// it), its length and the seconds since the start, holding the
+		// incumbent lock: keep it short
+		std::function<void(const std::vector<int>&, int, double)> incumbent;
+	};
+
+	struct Result {
+		std::vector<int> tour;	// closed, from city 0 back to it
+		int distance;
+		int lowerBound;		// over what was left open, distance when complete; a 1-tree for the heuristic
+		long nodes;			// # of paths expanded, kicks for the heuristic
+		StopReason stop;
+		double seconds;		// from the start of the search
+		double foundAfter;	// seconds to the last shorter tour
+	};
+
+private:
+	Options _options;
+
+	static inline std::recursive_mutex _solving;	// one solve at a time
+
+	// drop what the last solve left
+	static void clear()
+	{
+		delete global.shortest;
+		delete global.table;
+		delete global.heldKarp;
+		delete global.candidates;
+		delete global.assignment;
+		delete global.heuristic;
+		global.shortest = 0;
+		global.table = 0;
+		global.heldKarp = 0;
+		global.candidates = 0;
+		global.assignment = 0;
+		global.heuristic = 0;
+		global.nodes = 0;
+		global.splits = 0;
+		global.hungry = 0;
+		global.idle = 0;
+		global.active = 0;
+		global.openBound = INT_MAX;
+		global.lowerBound = 0;
+		global.pause = false;
+		global.parked = 0;
+		global.snapshot = false;
+		global.saving = 0;
+		global.saved.clear();
+		global.finished = 0;
+		global.queued = 0;
+		global.granularity.local = false;
+		global.granularity.switches = 0;
+		global.tt.probes = global.tt.hits = global.tt.pruned = 0;
+		global.improver.pending = false;
+		global.improver.published = 0;
+	}
+
+	// run the engine chosen from seeds, starting from shortest if
+	// given, else from the trivial tour; takes both over
+	Result run(Graph* g, std::vector<Path*>& seeds, Path* shortest, long nodes)
+	{
+		std::lock_guard<std::recursive_mutex> solving(_solving);
+		clear();
+		global.verbose = _options.verbose;
+		global.threads = std::max(_options.threads, 1);
+		global.pin = _options.pin;
+		global.queue = _options.queue;
+		global.engine = _options.engine;
+		global.frontier = _options.frontier;
+		global.memoryCap = _options.memory;
+		global.spillDir = _options.spillDir.c_str();
+		global.adaptive = _options.adaptive;
+		global.nodeLimit = _options.nodeLimit;
+		global.timeLimit = _options.timeLimit;
+		global.checkpoint = _options.checkpoint.empty() ? 0 : _options.checkpoint.c_str();
+		global.checkpointInterval = _options.checkpointInterval;
+		global.improve = _options.improve;
+		global.incumbent = _options.incumbent;
+		if (global.engine == ENGINE_HEURISTIC)
+			return heuristic(g);
+		if (_options.tt > 0)
+			global.table = new TranspositionTable(_options.tt * (1 << 20));
+		if (_options.assignment)
+			global.assignment = new Assignment(g);
+
+		if (!shortest) {
+			shortest = new Path(g);
+			for (int i=0; i<g->size(); i++)
+				shortest->add(i);
+			shortest->add(0);
+		}
+		global.shortest = shortest;
+		global.nodes = nodes;
+
+		auto start = std::chrono::steady_clock::now();
+		if (_options.heldKarp >= 0 || global.assignment) {
+			// bounds only prune against a fair incumbent, and Held-Karp
+			// step sizes need one too: the trivial tour is not one
+			std::vector<int> tour = LocalSearch::nearest(g);
+			if (g->symmetric())
+				LocalSearch::improve(g, tour);
+			if (LocalSearch::length(g, tour) < global.shortest->distance())
+				LocalSearch::path(tour, global.shortest);
+		}
+		if (_options.heldKarp >= 0) {
+			global.heldKarp = new HeldKarp(g, _options.heldKarp, global.shortest->distance());
+			if (_options.eliminate)
+				global.candidates = new Candidates(g, global.heldKarp, global.shortest->distance());
+		}
+		global.bound = global.shortest->distance();
+		global.start = global.foundAt = start;
+		global.deadline = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+			std::chrono::duration<double>(global.timeLimit));
+
+		if (global.engine == ENGINE_DFS) {
+			solve_depth_first(g, seeds);
+		} else if (global.engine == ENGINE_DET) {
+			solve_deterministic(g, seeds);
+#ifdef _OPENMP
+		} else if (global.engine == ENGINE_OMP) {
+			solve_omp(g, seeds);
+#endif
+		} else if (global.frontier == FRONTIER_PREFIX) {
+			solve_breadth_first<Prefix*>(g, seeds);
+			// every entry was dropped with the frontier
+			Prefix::reset();
+		} else {
+			solve_breadth_first<Path*>(g, seeds);
+		}
+
+		Result r;
+		for (int i=0; i<global.shortest->size(); i++)
+			r.tour.push_back(global.shortest->node(i));
+		r.distance = global.shortest->distance();
+		return finish(r, start);
+	}
+
+	// run the heuristic engine
+	Result heuristic(Graph* g)
+	{
+		auto start = std::chrono::steady_clock::now();
+		global.bound = INT_MAX;
+		global.start = global.foundAt = start;
+		global.deadline = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+			std::chrono::duration<double>(global.timeLimit));
+		solve_heuristic(g);
+
+		Result r;
+		r.tour = global.heuristic->tour();
+		r.distance = global.heuristic->length();
+		return finish(r, start);
+	}
+
+	// the rest of r, for a solve that began at start
+	static Result& finish(Result& r, std::chrono::steady_clock::time_point start)
+	{
+		r.lowerBound = global.lowerBound;
+		r.nodes = global.nodes;
+		r.stop = (StopReason) global.stop.load();
+		std::chrono::duration<double> secs = std::chrono::steady_clock::now() - start;
+		std::chrono::duration<double> found = global.foundAt - start;
+		r.seconds = secs.count();
+		r.foundAfter = found.count();
+
+		// ready for the next one, which a stop() from now on stops
+		std::lock_guard<std::mutex> guard(global.cancelMutex);
+		global.stop = STOP_NONE;
+		global.cancel = std::stop_source();
+		return r;
+	}
+
+public:
+	Solver() {}
+	Solver(const Options& options) : _options(options) {}
+
+	const Options& options() const { return _options; }
+
+	// whether the options go together
+	static bool valid(const Options& o)
+	{
+		if ((o.engine == ENGINE_DFS || o.engine == ENGINE_OMP) && !o.checkpoint.empty())
+			return false;
+		if (o.engine == ENGINE_DET && (!o.checkpoint.empty() || o.tt > 0 || o.improve))
+			return false;
+		if (o.memory && (o.engine != ENGINE_BFS || !o.checkpoint.empty()))
+			return false;
+		if (o.eliminate && o.heldKarp < 0)
+			return false;
+		if (o.engine == ENGINE_HEURISTIC && (!o.checkpoint.empty() || o.tt > 0 || o.improve
+				|| o.heldKarp >= 0 || o.assignment))
+			return false;
+#ifndef _OPENMP
+		if (o.engine == ENGINE_OMP)
+			return false;
+#endif
+		return true;
+	}
+
+	// why g cannot be solved with o, 0 if it can
+	static const char* unsupported(const Options& o, const Graph* g)
+	{
+		if (o.engine == ENGINE_HEURISTIC)
+			return g->symmetric() ? 0 : "the heuristic needs symmetric distances";
+		if (g->size() >= Path::MAX)
+			return "too many cities";
+		if ((o.heldKarp >= 0 || o.improve) && !g->symmetric())
+			return "--held-karp and --improve need symmetric distances";
+		return 0;
+	}
+
+	// the shortest tour of g, searched from city 0
+	Result solve(Graph* g)
+	{
+		std::vector<Path*> seeds;
+		if (_options.engine != ENGINE_HEURISTIC) {
+			Path* root = new Path(g);
+			root->add(0);
+			seeds.push_back(root);
+		}
+		return run(g, seeds, 0, 0);
+	}
+
+	// the same, going on from a checkpoint of g, whose paths it takes over
+	Result solve(Graph* g, Checkpoint::State& from)
+	{
+		Result r = run(g, from.frontier, from.shortest, from.nodes);
+		from.shortest = 0;
+		from.frontier.clear();
+		return r;
+	}
+
+	// the same for the cities at x, y, as EUC_2D distances
+	Result solve(const std::vector<double>& x, const std::vector<double>& y)
+	{
+		Graph* g = TSPFile::euclidean(x, y);
+		std::lock_guard<std::recursive_mutex> solving(_solving);
+		Result r = solve(g);
+		delete global.shortest;		// refers to g
+		global.shortest = 0;
+		delete g;
+		return r;
+	}
+
+	// stop the solve under way, or the next one, from any thread; the
+	// result is the best tour found so far. safe from a signal watcher,
+	// not from a signal handler
+	static void stop()
+	{
+		request_stop(STOP_CALLER);
+	}
+
+	// what the last solve's bounds and helpers did
+	void report(std::ostream& out, const Result& r) const
+	{
+		if (global.improve)
+			out << "local search: " << global.improver.published << " improved tours, best found after "
+				<< r.foundAfter << "s\n";
+		if (global.engine == ENGINE_DFS)
+			out << "subtrees split off: " << global.splits.load() << '\n';
+		if (global.heuristic)
+			out << "heuristic: " << global.heuristic->kicks() << " kicks, " << global.heuristic->improved()
+				<< " shorter tours, " << global.heuristic->restarts() << " restarts from the best, last after "
+				<< r.foundAfter << "s\n";
+		if (global.heldKarp)
+			out << "held-karp: root bound " << global.heldKarp->root() << " after "
+				<< global.heldKarp->iterations() << " iterations, root gap "
+				<< (100. * (r.distance - global.heldKarp->root()) / r.distance) << "%\n";
+		if (global.candidates) {
+			int n = r.tour.size() - 1;
+			out << "candidates: " << global.candidates->edges() << " of " << n * (n - 1) / 2 << " edges kept, "
+				<< (2. * global.candidates->edges() / n) << " per city\n";
+		}
+		if (global.table) {
+			long probes = global.tt.probes;
+			out << "transposition table: " << (global.table->bytes() >> 10) << "KB, " << probes << " probes, "
+				<< global.tt.hits << " hits (" << (probes ? 100. * global.tt.hits / probes : 0) << "%), "
+				<< global.tt.pruned << " pruned\n";
+		}
+	}
+};
+
+#endif // _solver_hpp
@@ -0,0 +1,259 @@
+//
+//  spill.hpp
+//
+//  Overflow of a frontier to disk. Paths are encoded one byte per
+//  city (as in checkpoints) into batches; full batches are written to
+//  their own file by a background thread, and read back, oldest first,
+//  by the same thread before they are needed. Callers only ever copy
+//  batches in and out of memory, never wait for a write, and wait for
+//  a read only when nothing else is left to do. A batch that cannot be
+//  read back is lost: take() returns false on it, and failed() tells.
+//
+//  a batch file: { uint8 size, cities } per path
+//
+
+#ifndef _spill_hpp
+#define _spill_hpp
+
+#include <iostream>
+#include <cstdio>
+#include <cstdint>
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <unistd.h>
+
+#include "graph.hpp"
+#include "path.hpp"
+
+class Spill {
+private:
+	enum State { MEMORY, WRITING, DISK, READING, LOST };
+
+	struct Batch {
+		State state;
+		std::string data;	// encoded paths, while not on disk
+		std::string file;
+		long count;
+	};
+
+	const int _batch;		// paths per batch
+	std::string _prefix;	// batch file names, followed by a number
+	long _files;
+
+	std::mutex _mutex;
+	std::condition_variable _work;		// for the I/O thread
+	std::condition_variable _ready;		// for callers waiting on a read
+	std::deque<Batch> _batches;			// oldest first
+	std::string _current;				// batch being filled
+	long _currentCount;
+	std::atomic<long> _size;			// # of paths held
+	bool _done;
+	std::thread _io;
+
+	bool _disk;				// false once a write failed
+	std::atomic<bool> _failed;	// true once a read failed
+	std::atomic<long> _written;	// # of batches through the disk
+	long _read;
+
+	// next batch the I/O thread should move: the oldest one back to
+	// memory, or any other one out of it
+	Batch* pick()
+	{
+		if (_batches.empty())
+			return nullptr;
+		if (_batches.front().state == DISK)
+			return &_batches.front();
+		if (!_disk)
+			return nullptr;
+		for (size_t i=1; i<_batches.size(); i++)
+			if (_batches[i].state == MEMORY)
+				return &_batches[i];
+		return nullptr;
+	}
+
+	void run()
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+		while (true) {
+			Batch* b = nullptr;
+			_work.wait(lock, [&] { return _done || (b = pick()); });
+			if (_done)
+				break;
+			if (b->state == MEMORY) {
+				// deque elements stay put while others are added at the back
+				b->state = WRITING;
+				std::string data;
+				data.swap(b->data);
+				std::string file = b->file;
+				lock.unlock();
+				bool ok = write(file, data);
+				lock.lock();
+				if (ok) {
+					b->state = DISK;
+					_written ++;
+				} else {
+					b->data.swap(data);
+					b->state = MEMORY;
+					_disk = false;
+					unlink(file.c_str());
+					std::cerr << "cannot spill to " << file << " (" << std::strerror(errno) << "), keeping the frontier in memory\n";
+				}
+				_ready.notify_all();
+			} else {
+				b->state = READING;
+				std::string file = b->file;
+				lock.unlock();
+				std::string data;
+				bool ok = read(file, data);
+				lock.lock();
+				if (ok) {
+					b->data.swap(data);
+					b->state = MEMORY;
+					_read ++;
+				} else {
+					b->state = LOST;
+					_failed = true;
+				}
+				_ready.notify_all();
+			}
+		}
+	}
+
+	static bool write(const std::string& file, const std::string& data)
+	{
+		FILE* f = fopen(file.c_str(), "wb");
+		if (!f)
+			return false;
+		bool ok = fwrite(data.data(), 1, data.size(), f) == data.size();
+		return (fclose(f) == 0) && ok;
+	}
+
+	static bool read(const std::string& file, std::string& data)
+	{
+		FILE* f = fopen(file.c_str(), "rb");
+		if (!f) {
+			std::cerr << "cannot read back " << file << " (" << std::strerror(errno) << ")\n";
+			return false;
+		}
+		char buf[1 << 16];
+		size_t n;
+		while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+			data.append(buf, n);
+		bool ok = !ferror(f);
+		if (!ok)
+			std::cerr << "cannot read back " << file << " (" << std::strerror(errno) << ")\n";
+		fclose(f);
+		unlink(file.c_str());
+		return ok;
+	}
+
+	// close the batch being filled, caller holds the lock
+	void seal()
+	{
+		Batch b;
+		b.state = MEMORY;
+		b.data.swap(_current);
+		b.file = _prefix + std::to_string(_files ++);
+		b.count = _currentCount;
+		_batches.push_back(std::move(b));
+		_currentCount = 0;
+		_work.notify_one();
+	}
+
+public:
+	// batches of batch paths, in files named dir/tspcc-<pid>-<n>
+	Spill(const std::string& dir, int batch) : _batch(batch)
+	{
+		_prefix = dir + "/tspcc-" + std::to_string(getpid()) + "-";
+		_files = 0;
+		_currentCount = 0;
+		_size = 0;
+		_done = false;
+		_disk = true;
+		_failed = false;
+		_written = _read = 0;
+		_io = std::thread(&Spill::run, this);
+	}
+
+	~Spill()
+	{
+		{
+			std::lock_guard<std::mutex> guard(_mutex);
+			_done = true;
+			_work.notify_one();
+		}
+		_io.join();
+		for (Batch& b : _batches)
+			if (b.state == DISK)
+				unlink(b.file.c_str());
+	}
+
+	long size() const { return _size.load(); }
+	long written() const { return _written.load(); }
+	bool failed() const { return _failed.load(); }
+
+	void put(const Path* p)
+	{
+		char buf[Path::MAX + 1];
+		buf[0] = p->size();
+		for (int i=0; i<p->size(); i++)
+			buf[i + 1] = p->node(i);
+		std::lock_guard<std::mutex> guard(_mutex);
+		_current.append(buf, p->size() + 1);
+		_size ++;
+		if (++ _currentCount == _batch)
+			seal();
+	}
+
+	// take the oldest batch into out; waits only if it is being read
+	// back, and only if wait is set. returns false if nothing was taken,
+	// dropping the oldest batch if it was lost
+	bool take(Graph* g, std::vector<Path*>& out, bool wait)
+	{
+		std::string data;
+		long count;
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			while (true) {
+				if (_batches.empty()) {
+					if (_currentCount == 0)
+						return false;
+					seal();
+				}
+				if (_batches.front().state == MEMORY)
+					break;
+				if (_batches.front().state == LOST) {
+					_size -= _batches.front().count;
+					_batches.pop_front();
+					_work.notify_one();
+					return false;
+				}
+				if (!wait)
+					return false;
+				_ready.wait(lock);
+			}
+			data.swap(_batches.front().data);
+			count = _batches.front().count;
+			_batches.pop_front();
+			_size -= count;
+			_work.notify_one();
+		}
+		for (size_t i=0; i<data.size(); ) {
+			Path* p = new Path(g);
+			int size = (uint8_t) data[i ++];
+			for (int k=0; k<size; k++)
+				p->add((uint8_t) data[i ++]);
+			out.push_back(p);
+		}
+		return true;
+	}
+};
+
+#endif // _spill_hpp
@@ -0,0 +1,114 @@
+//
+//  table.hpp
+//
+//  Lock-free transposition table for dominance pruning: two paths
+//  through the same set of cities ending on the same city have the
+//  same completions, so the longer one cannot lead to a shorter tour.
+//  An entry packs (cities, last city) and the best prefix distance
+//  seen into one 64-bit word, updated with CAS. The table has a fixed
+//  size; buckets are one cache line, and when a bucket is full the
+//  deepest entry is replaced, since shallow prefixes prune more.
+//
+
+#ifndef _table_hpp
+#define _table_hpp
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+#include "path.hpp"
+
+class TranspositionTable {
+private:
+	static const int BUCKET = 8;	// entries per 64-byte bucket
+	static const int LAST_BITS = 5;
+
+	// (cities << LAST_BITS | last) + 1 must fit in 32 bits, 0 is empty
+	static_assert(Path::MAX + LAST_BITS < 32, "path too long for table keys");
+	static_assert((1 << LAST_BITS) >= Path::MAX, "last city does not fit");
+
+	struct alignas(64) Bucket {
+		std::atomic<uint64_t> entries[BUCKET];
+	};
+
+	Bucket* _buckets;
+	size_t _mask;
+
+	static uint32_t key(uint64_t cities, int last)
+	{
+		return (uint32_t) ((cities << LAST_BITS) | last) + 1;
+	}
+
+	static int depth(uint64_t entry)
+	{
+		return __builtin_popcountll((entry >> 32) >> LAST_BITS);
+	}
+
+public:
+	enum Result {
+		MISS,		// not in the table, now inserted if there was room
+		IMPROVED,	// in the table with a longer distance, now replaced
+		DOMINATED,	// in the table with a distance as short or shorter
+	};
+
+	// a table of about bytes bytes (rounded down to a power of two buckets)
+	TranspositionTable(size_t bytes)
+	{
+		size_t n = 1;
+		while (n * 2 * sizeof(Bucket) <= bytes)
+			n *= 2;
+		_mask = n - 1;
+		_buckets = new Bucket[n];
+		for (size_t i=0; i<n; i++)
+			for (int j=0; j<BUCKET; j++)
+				_buckets[i].entries[j].store(0, std::memory_order_relaxed);
+	}
+
+	~TranspositionTable()
+	{
+		delete[] _buckets;
+		_buckets = 0;
+	}
+
+	size_t bytes() const { return (_mask + 1) * sizeof(Bucket); }
+
+	// look p up and record it; DOMINATED means p need not be expanded
+	Result check(const Path* p)
+	{
+		uint32_t k = key(p->mask(), p->node(p->size() - 1));
+		uint64_t entry = ((uint64_t) k << 32) | (uint32_t) p->distance();
+		Bucket& b = _buckets[(k * 0x9E3779B97F4A7C15ULL >> 20) & _mask];
+
+		while (true) {
+			int victim = -1;
+			int deepest = -1;
+			uint64_t old = 0;
+			for (int i=0; i<BUCKET; i++) {
+				uint64_t e = b.entries[i].load(std::memory_order_relaxed);
+				if ((uint32_t) (e >> 32) == k) {
+					if ((uint32_t) e <= (uint32_t) p->distance())
+						return DOMINATED;
+					if (b.entries[i].compare_exchange_strong(e, entry, std::memory_order_relaxed))
+						return IMPROVED;
+					victim = -2;	// changed under us, look again
+					break;
+				}
+				int d = e ? depth(e) : Path::MAX + 1;
+				if (d > deepest) {
+					deepest = d;
+					victim = i;
+					old = e;
+				}
+			}
+			if (victim == -2)
+				continue;
+			// replace the deepest entry only if it is at least as deep as p
+			if (deepest >= p->size())
+				b.entries[victim].compare_exchange_strong(old, entry, std::memory_order_relaxed);
+			return MISS;
+		}
+	}
+};
+
+#endif // _table_hpp
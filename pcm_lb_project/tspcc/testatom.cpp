@@ -1,15 +1,21 @@
 // compiler avec:
-// g++ -o testatom testatom.cpp
+// g++ -std=c++20 -o testatom testatom.cpp -latomic -pthread
+// testatom -b also runs a contended CAS benchmark
 
 #include <iostream>
+#include <thread>
+#include <vector>
+#include <chrono>
 
 #include "atomicstamped.hpp"
 
 
-int main()
+template <template <class> class R>
+void test(const char* name)
 {
+	std::cout << name << '\n';
 	std::string sa = "a";
-	AtomicStamped<std::string> ar(&sa, 10);
+	R<std::string> ar(&sa, 10);
 
 	uint64_t stamp;
 	std::string* sp = ar.get(stamp);
@@ -23,6 +29,56 @@ int main()
 	c = ar.cas(&sa, &sb, 10, 12);
 	sp = ar.get(stamp);
 	std::cout << "(cas=" << c << ") string = " << *sp << " stamp = " << stamp << '\n';
+}
+
+// each thread bumps the stamp ops times, retrying failed CAS
+template <template <class> class R>
+void bump(R<int>* ar, int ops, long* failed)
+{
+	uint64_t stamp;
+	for (int i=0; i<ops; i++) {
+		while (true) {
+			int* p = ar->get(stamp);
+			if (ar->cas(p, p, stamp, stamp+1))
+				break;
+			(*failed) ++;
+		}
+	}
+}
+
+template <template <class> class R>
+void bench(const char* name, int nthreads, int ops)
+{
+	int x;
+	R<int> ar(&x, 0);
+	std::vector<long> failed(nthreads, 0);
+	auto start = std::chrono::steady_clock::now();
+	std::vector<std::thread> threads;
+	for (int i = 0; i < nthreads; i++)
+		threads.push_back(std::thread(bump<R>, &ar, ops, &failed[i]));
+	for (auto &th : threads)
+		th.join();
+	std::chrono::duration<double> secs = std::chrono::steady_clock::now() - start;
+	long fails = 0;
+	for (long f : failed)
+		fails += f;
+	uint64_t stamp;
+	ar.get(stamp);
+	std::cout << name << ' ' << nthreads << " threads: " << (long) (nthreads * ops / secs.count())
+		<< " cas/s, " << fails << " failed, stamp " << stamp << '\n';
+}
+
+int main(int argc, char* argv[])
+{
+	test<AtomicStamped>("AtomicStamped");
+	test<AtomicTagged>("AtomicTagged");
 
+	if (argc > 1 && argv[1][0] == '-' && argv[1][1] == 'b') {
+		int ops = 4000000;
+		for (int n = 1; n <= 8; n *= 2) {
+			bench<AtomicStamped>("stamped", n, ops / n);
+			bench<AtomicTagged>("tagged ", n, ops / n);
+		}
+	}
 	return 0;
 }
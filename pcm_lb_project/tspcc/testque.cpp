@@ -1,11 +1,15 @@
 //
-//  compiler avec g++ -std=c++11 -o testque testque.cpp
+//  compiler avec g++ -std=c++20 -o testque testque.cpp -latomic -pthread
+//  testque -b also runs a throughput benchmark, with CAS counters
+//  when built with -DCAS_STATS (make casstats, into testque-casstats)
 //
 
 #include <iostream>
 #include <thread>
 #include <vector>
+#include <chrono>
 #include "queue.hpp"
+#include "ringqueue.hpp"
 
 struct Blob {
 	int n;
@@ -21,23 +25,18 @@ std::ostream &operator<<(std::ostream &os, Blob const &b)
 }
 
 
-template <class T>
-T sumup(Queue<T>* q, bool print = false)
+template <class Q, class T>
+T sumup(Q* q, bool print = false)
 {
 	T ret(0);
 	bool didonce = false;
 
-	while (true) {
-		try {
-			T val = q->dequeue();
-			if (print)
-				std::cout << (didonce ? ", " : "") << val;
-			ret = (ret + val);
-			didonce = true;
-		}
-		catch (EmptyQueueException e) {
-			break;
-		}
+	T val;
+	while (q->try_dequeue(val)) {
+		if (print)
+			std::cout << (didonce ? ", " : "") << val;
+		ret = (ret + val);
+		didonce = true;
 	}
 	if (print) {
 		if (didonce)
@@ -49,34 +48,154 @@ T sumup(Queue<T>* q, bool print = false)
 	return ret;
 }
 
-template <class T>
-void test(Queue<T>* q, int max)
+template <class Q, class T>
+void test(Q* q, int max)
 {
 	for (int i=1; i<max; i++)
 		q->enqueue(i);
 
-	T sum = sumup(q);
+	T sum = sumup<Q, T>(q);
 	q->enqueue(sum);
 }
 
-template <class T>
-void testthread()
+// same as test, with bulk operations
+template <class Q, class T>
+void testbulk(Q* q, int max)
 {
-	Queue<T> q;
+	std::vector<T> vals;
+	for (int i=1; i<max; i++)
+		vals.push_back(T(i));
+	q->enqueue_bulk(vals.data(), vals.data() + vals.size());
+
+	T sum(0);
+	T out[3];
+	int n;
+	while ((n = q->dequeue_bulk(out, 3)) > 0)
+		for (int i=0; i<n; i++)
+			sum = (sum + out[i]);
+	q->enqueue(sum);
+}
 
+template <class Q, class T>
+void testthread(Q* q, bool bulk = false)
+{
 	std::vector<std::thread> threads;
 	for (int i = 0; i < 20; i++)
-		threads.push_back(std::thread(test<T>, &q, 5));
+		threads.push_back(std::thread(bulk ? testbulk<Q, T> : test<Q, T>, q, 5));
+
+	for (auto &th : threads)
+		th.join();
+
+	sumup<Q, T>(q, true);
+}
+
+// each thread enqueues ops values and dequeues as many, in pairs
+template <class Q>
+void pairs(Q* q, int ops)
+{
+	int val;
+	for (int i=0; i<ops; i++) {
+		q->enqueue(i);
+		q->try_dequeue(val);
+	}
+}
 
+// same as pairs, 8 values per bulk operation
+template <class Q>
+void bulkpairs(Q* q, int ops)
+{
+	int vals[8] = { 0, 1, 2, 3, 4, 5, 6, 7 };
+	int out[8];
+	for (int i=0; i<ops; i+=8) {
+		q->enqueue_bulk(vals, vals + 8);
+		q->dequeue_bulk(out, 8);
+	}
+}
+
+template <class Q>
+void bench(const char* name, Q* q, int nthreads, int ops, bool bulk = false)
+{
+	CasStats before = CasCount::total();
+	auto start = std::chrono::steady_clock::now();
+	std::vector<std::thread> threads;
+	for (int i = 0; i < nthreads; i++)
+		threads.push_back(std::thread(bulk ? bulkpairs<Q> : pairs<Q>, q, ops));
 	for (auto &th : threads)
 		th.join();
+	std::chrono::duration<double> secs = std::chrono::steady_clock::now() - start;
+	std::cout << name << ' ' << nthreads << " threads: " << (long) (2. * nthreads * ops / secs.count()) << " ops/s\n";
+	if (CasCount::enabled)
+		(CasCount::total() - before).print(std::cout);
+}
 
-	sumup(&q, true);
+// polls of an empty queue per second, by exception or by try_dequeue
+void emptypolls(int ops)
+{
+	Queue<int> q;
+	int val, hits = 0;
+	auto start = std::chrono::steady_clock::now();
+	for (int i=0; i<ops; i++) {
+		try {
+			val = q.dequeue();
+			hits ++;
+		}
+		catch (EmptyQueueException& e) {
+		}
+	}
+	std::chrono::duration<double> secs = std::chrono::steady_clock::now() - start;
+	std::cout << "empty dequeue (throw): " << (long) (ops / secs.count()) << " polls/s\n";
+
+	start = std::chrono::steady_clock::now();
+	for (int i=0; i<ops; i++)
+		hits += q.try_dequeue(val);
+	secs = std::chrono::steady_clock::now() - start;
+	std::cout << "empty try_dequeue:     " << (long) (ops / secs.count()) << " polls/s\n";
+	if (hits)
+		std::cout << "queue not empty!\n";
 }
 
-int main()
+int main(int argc, char* argv[])
 {
-	testthread<int>();
-	testthread<Blob>();
+	Queue<int> qi;
+	testthread<Queue<int>, int>(&qi);
+	Queue<Blob> qb;
+	testthread<Queue<Blob>, Blob>(&qb);
+
+	Queue<int, NoBackoff, AtomicTagged> ti;
+	testthread<Queue<int, NoBackoff, AtomicTagged>, int>(&ti);
+	Queue<Blob, NoBackoff, AtomicTagged> tb;
+	testthread<Queue<Blob, NoBackoff, AtomicTagged>, Blob>(&tb);
+
+	// small rings, so that some values go to the overflow queue
+	RingQueue<int> ri(16);
+	testthread<RingQueue<int>, int>(&ri);
+	RingQueue<Blob> rb(16);
+	testthread<RingQueue<Blob>, Blob>(&rb);
+
+	testthread<Queue<int>, int>(&qi, true);
+	testthread<Queue<Blob>, Blob>(&qb, true);
+	testthread<Queue<int, NoBackoff, AtomicTagged>, int>(&ti, true);
+	testthread<RingQueue<int>, int>(&ri, true);
+	testthread<RingQueue<Blob>, Blob>(&rb, true);
+
+	// testque -b: throughput of both queues under contention
+	if (argc > 1 && argv[1][0] == '-' && argv[1][1] == 'b') {
+		int ops = 1000000;
+		for (int n = 1; n <= 8; n *= 2) {
+			Queue<int> q;
+			bench("queue", &q, n, ops / n);
+			Queue<int, ExpBackoff<> > qe;
+			bench("queue backoff", &qe, n, ops / n);
+			Queue<int, NoBackoff, AtomicTagged> qt;
+			bench("queue tagged", &qt, n, ops / n);
+			RingQueue<int> r(1024);
+			bench("ring ", &r, n, ops / n);
+			Queue<int> qb;
+			bench("queue bulk", &qb, n, ops / n, true);
+			RingQueue<int> rb(1024);
+			bench("ring bulk ", &rb, n, ops / n, true);
+		}
+		emptypolls(ops);
+	}
 	return 0;
 }
\ No newline at end of file
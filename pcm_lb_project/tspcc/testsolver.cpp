@@ -0,0 +1,73 @@
+//
+//  compiler avec make testsolver
+//  testsolver file.tsp: solves one instance back to back with each
+//  exact engine, in the same process, checks they agree and that the
+//  heuristic is no better; then a few random cities given by
+//  coordinates, counting the shorter tours
+//
+
+#include <iostream>
+#include <vector>
+#include <random>
+#include "solver.hpp"
+
+int main(int argc, char* argv[])
+{
+	if (argc != 2) {
+		std::cerr << "usage: " << argv[0] << " file.tsp\n";
+		return 1;
+	}
+	Graph* g = TSPFile::graph(argv[1]);
+	if (g->size() >= Path::MAX) {
+		std::cerr << "at most " << Path::MAX - 1 << " cities\n";
+		return 1;
+	}
+
+	static const EngineKind engines[] = { ENGINE_BFS, ENGINE_DFS, ENGINE_DET };
+	static const char* names[] = { "bfs", "dfs", "det" };
+	Solver::Options options;
+	options.threads = 2;
+	int shortest = -1;
+	bool ok = true;
+	for (int i=0; i<3; i++) {
+		options.engine = engines[i];
+		options.frontier = (i == 0) ? FRONTIER_PREFIX : FRONTIER_PATH;
+		Solver solver(options);
+		Solver::Result r = solver.solve(g);
+		std::cout << names[i] << ": " << r.distance << " after " << r.nodes << " nodes, " << r.seconds << "s\n";
+		if (shortest >= 0 && r.distance != shortest)
+			ok = false;
+		shortest = r.distance;
+	}
+
+	// no shorter than the optimum, and no proof either
+	options.engine = ENGINE_HEURISTIC;
+	Solver::Result h = Solver(options).solve(g);
+	std::cout << "heuristic: " << h.distance << " after " << h.nodes << " kicks, " << h.seconds << "s\n";
+	if (h.distance < shortest || h.lowerBound > shortest || h.stop != STOP_STALL)
+		ok = false;
+
+	std::mt19937 random(1);
+	std::uniform_real_distribution<double> coord(0, 1000);
+	std::vector<double> x, y;
+	for (int i=0; i<12; i++) {
+		x.push_back(coord(random));
+		y.push_back(coord(random));
+	}
+	options.engine = ENGINE_DFS;
+	int found = 0, last = INT_MAX;
+	options.incumbent = [&](const std::vector<int>&, int length, double) {
+		if (length >= last)
+			ok = false;
+		last = length;
+		found ++;
+	};
+	Solver solver(options);
+	Solver::Result r = solver.solve(x, y);
+	std::cout << "12 random cities: " << r.distance << ", " << found << " shorter tours\n";
+	if (!found || last != r.distance || r.tour.size() != 13)
+		ok = false;
+
+	std::cout << (ok ? "ok" : "FAILED") << '\n';
+	return ok ? 0 : 1;
+}
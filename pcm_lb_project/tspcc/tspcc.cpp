@@ -7,34 +7,19 @@
 #include "graph.hpp"
 #include "path.hpp"
 #include "tspfile.hpp"
-#include "queue.hpp"
+#include "checkpoint.hpp"
+#include "distributed.hpp"
+#include "shared.hpp"
+#include "solver.hpp"
 
 #include <thread>
-
-#define MAX_DEPTH 10
-
-enum Verbosity {
-	VER_NONE = 0,
-	VER_GRAPH = 1,
-	VER_SHORTER = 2,
-	VER_BOUND = 4,
-	VER_ANALYSE = 8,
-	VER_COUNTERS = 16,
-};
-
-static struct {
-	Path* shortest;
-	Verbosity verbose;
-    Queue<Path*> queue;
-	struct {
-		int verified;	// # of paths checked
-		int found;	// # of times a shorter path was found
-		int* bound;	// # of bound operations per level
-	} counter;
-	int size;
-	int total;		// number of paths to check
-	int* fact;
-} global;
+#include <csignal>
+#include <string>
+#include <chrono>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/resource.h>
+#include <pthread.h>
 
 static const struct {
 	char RED[6];
@@ -46,160 +31,356 @@ static const struct {
 	.ORIGINAL = { 27, '[', '3', '9', 'm', 0 },
 };
 
-// create a mutex to print to the console
-std::mutex printMutex;
-// create a function to print to the console
-void print(const std::string& message, Path *path = nullptr)
+// turn SIGINT and SIGTERM into a stop request, so that the best tour
+// so far is still reported: the signals are blocked in every thread
+// started from now on and taken by this one, where stopping is safe.
+// a second signal quits at once
+static std::jthread watch_signals()
 {
-	std::lock_guard<std::mutex> guard(printMutex);
-    if (path != nullptr)
-		std::cout << message << path << std::endl;
-	else
-		std::cout << message << std::endl;
+	sigset_t set;
+	sigemptyset(&set);
+	sigaddset(&set, SIGINT);
+	sigaddset(&set, SIGTERM);
+	sigaddset(&set, SIGUSR1);	// wakes the watcher to leave
+	pthread_sigmask(SIG_BLOCK, &set, nullptr);
+	return std::jthread([set](std::stop_token leave) {
+		pthread_t self = pthread_self();
+		std::stop_callback wake(leave, [self] { pthread_kill(self, SIGUSR1); });
+		bool stopping = false;
+		int sig;
+		while (sigwait(&set, &sig) == 0 && !leave.stop_requested()) {
+			if (sig == SIGUSR1)
+				continue;
+			if (stopping)
+				std::_Exit(128 + sig);
+			stopping = true;
+			std::cerr << "stopping, signal again to quit at once\n";
+			Solver::stop();
+		}
+	});
 }
 
-static void threaded_branch_and_bound()
+// as Path prints itself
+static void print_tour(std::ostream& out, const std::vector<int>& tour, int length)
 {
-  	while (!global.queue.empty()) {
-        Path* current = global.queue.dequeue();
-
-    	print("analysing ", current);
-
-        //if (current->size() >= MAX_DEPTH) {
-			if (current->leaf()) {
-				// this is a leaf
-				current->add(0);
-				if (current->distance() < global.shortest->distance()) {
-					global.shortest->copy(current);
-				}
-				current->pop();
-			} else {
-				// not yet a leaf
-				if (current->distance() < global.shortest->distance()) {
-					// continue branching
-					for (int i=1; i<current->max(); i++) {
-						if (!current->contains(i)) {
-							current->add(i);
-		                    global.queue.enqueue(new Path(*current));
-							current->pop();
-						}
-					}
-				}
-			}
-//        } else {
-//		    // not yet at max depth
-//		    if (current->distance() < global.shortest->distance()) {
-//				for (int i=1; i<current->max(); i++) {
-//					if (!current->contains(i)) {
-//						current->add(i);
-//						global.queue.enqueue(new Path(*current));
-//						current->pop();
-//					}
-//				}
-//			}
-//        }
-    }
+	out << '[' << length;
+	for (size_t i=0; i<tour.size(); i++)
+		out << (i ? ',' : ':') << ' ' << tour[i];
+	out << ']';
 }
 
-void reset_counters(int size)
+static void usage(const char* prog)
 {
-	global.size = size;
-	global.counter.verified = 0;
-	global.counter.found = 0;
-	global.counter.bound = new int[global.size];
-	global.fact = new int[global.size];
-	for (int i=0; i<global.size; i++) {
-		global.counter.bound[i] = 0;
-		if (i) {
-			int pos = global.size - i;
-			global.fact[pos] = (i-1) ? (i * global.fact[pos+1]) : 1;
-		}
-	}
-	global.total = global.fact[0] = global.fact[1];
-}
-
-void print_counters()
-{
-	std::cout << "total: " << global.total << '\n';
-	std::cout << "verified: " << global.counter.verified << '\n';
-	std::cout << "found shorter: " << global.counter.found << '\n';
-	std::cout << "bound (per level):";
-	for (int i=0; i<global.size; i++)
-		std::cout << ' ' << global.counter.bound[i];
-	std::cout << "\nbound equivalent (per level): ";
-	int equiv = 0;
-	for (int i=0; i<global.size; i++) {
-		int e = global.fact[i] * global.counter.bound[i];
-		std::cout << ' ' << e;
-		equiv += e;
-	}
-	std::cout << "\nbound equivalent (total): " << equiv << '\n';
-	std::cout << "check: total " << (global.total==(global.counter.verified + equiv) ? "==" : "!=") << " verified + total bound equivalent\n";
+	fprintf(stderr, "usage: %s [-v#] [-t threads] [-p] [-q ms|msb|mst|ring] [-e bfs|dfs|det|omp|heuristic]\n", prog);
+	fprintf(stderr, "       [--frontier path|prefix] [--memory megabytes [--spill-dir dir]] [--adaptive]\n");
+	fprintf(stderr, "       [--time-limit seconds] [--node-limit nodes]\n");
+	fprintf(stderr, "       [--checkpoint file [--checkpoint-interval seconds]] [--resume file]\n");
+	fprintf(stderr, "       [--processes n [--socket path | --shm] | --connect path] [--tt megabytes]\n");
+	fprintf(stderr, "       [--improve] [--held-karp iterations [--eliminate]] [--assignment]\n");
+	fprintf(stderr, "       filename\n");
+	fprintf(stderr, "  -v#         verbosity mask (default 1)\n");
+	fprintf(stderr, "  -t threads  number of workers (default: hardware concurrency)\n");
+	fprintf(stderr, "  -p          pin workers to cores (and NUMA nodes when built with NUMA)\n");
+	fprintf(stderr, "  -q queue    frontier queue: ms (linked, default), msb (linked with backoff),\n");
+	fprintf(stderr, "              mst (linked with 64-bit tagged pointers) or ring (bounded array)\n");
+	fprintf(stderr, "  -e engine   search order: bfs (shared frontier queue, default) or dfs (a stack\n");
+	fprintf(stderr, "              per worker, subtrees split off for idle workers; no checkpoints)\n");
+	fprintf(stderr, "              or det (prefixes dealt to the workers, incumbents shared in rounds:\n");
+	fprintf(stderr, "              same tour and node count for the same -t; no checkpoints, --tt\n");
+	fprintf(stderr, "              or --improve), or omp (OpenMP tasks, built into tspcc-omp;\n");
+	fprintf(stderr, "              no checkpoints), or heuristic (2-opt and Or-opt from kicks of the best\n");
+	fprintf(stderr, "              tour, a tour of its own per worker: a short tour of up to 10000\n");
+	fprintf(stderr, "              cities, not a proven one, with a 1-tree bound; -v2 shows it\n");
+	fprintf(stderr, "              shrinking. only limits and -t, -p, -v apply)\n");
+	fprintf(stderr, "  --frontier entries    breadth-first frontier of whole paths (default), or of\n");
+	fprintf(stderr, "                        prefixes sharing their parents' cities (less memory)\n");
+	fprintf(stderr, "  --memory megabytes    keep about that much of the breadth-first frontier in memory,\n");
+	fprintf(stderr, "                        spilling the rest to disk (no checkpoints)\n");
+	fprintf(stderr, "  --spill-dir dir       where spilled paths go (default $TMPDIR or /tmp)\n");
+	fprintf(stderr, "  --adaptive            workers keep their children depth-first while the frontier is\n");
+	fprintf(stderr, "                        long and nobody is idle, and queue them otherwise\n");
+	fprintf(stderr, "  --time-limit seconds  stop after that wall-clock time, report best tour and gap\n");
+	fprintf(stderr, "  --node-limit nodes    stop after expanding that many paths, same report\n");
+	fprintf(stderr, "                        (SIGINT or SIGTERM stops the same way, a second one at once)\n");
+	fprintf(stderr, "  --checkpoint file     save the search state there periodically and when stopped early\n");
+	fprintf(stderr, "  --checkpoint-interval seconds  between two checkpoints (default 60)\n");
+	fprintf(stderr, "  --resume file         continue the search saved in that checkpoint\n");
+	fprintf(stderr, "  --processes n         coordinate n worker processes instead of threads (of the other\n");
+	fprintf(stderr, "                        options, only -v, --socket and --shm apply)\n");
+	fprintf(stderr, "  --socket path         UNIX socket of the coordinator (default /tmp/tspcc-<pid>.sock)\n");
+	fprintf(stderr, "  --connect path        run as a worker process of the coordinator at path\n");
+	fprintf(stderr, "  --shm                 processes share the graph, bound and work pool in shared memory\n");
+	fprintf(stderr, "  --tt megabytes        prune dominated paths with a transposition table of that size\n");
+	fprintf(stderr, "  --improve             improve each new shortest tour by local search on a spare thread\n");
+	fprintf(stderr, "  --held-karp iterations  bound paths with 1-tree node penalties from that many\n");
+	fprintf(stderr, "                        subgradient iterations at the root (0: plain 1-tree)\n");
+	fprintf(stderr, "  --eliminate           branch only along edges whose reduced cost leaves room\n");
+	fprintf(stderr, "                        for a shorter tour (needs --held-karp)\n");
+	fprintf(stderr, "  --assignment          bound paths with the assignment problem, also for asymmetric\n");
+	fprintf(stderr, "                        (EXPLICIT FULL_MATRIX) distances\n");
+	exit(1);
 }
 
 int main(int argc, char* argv[])
 {
-	char* fname = 0;
-	if (argc == 2) {
-		fname = argv[1];
-        // verbose of all
-		global.verbose = (Verbosity) 0x1F;
-    	global.verbose = VER_NONE;
-	} else {
-		if (argc == 3 && argv[1][0] == '-' && argv[1][1] == 'v') {
-			global.verbose = (Verbosity) (argv[1][2] ? atoi(argv[1]+2) : 1);
-			fname = argv[2];
-		} else {
-			fprintf(stderr, "usage: %s [-v#] filename\n", argv[0]);
-			exit(1);
+	Solver::Options options;
+	const char* resume = 0;		// checkpoint file to start from
+	int processes = 0;			// # of worker processes, 0 for threads
+	const char* socket = 0;		// coordinator socket
+	const char* connect = 0;	// socket of the coordinator to work for
+	bool shm = false;			// processes share memory instead of sockets
+
+	enum { OPT_TIME_LIMIT = 256, OPT_NODE_LIMIT, OPT_CHECKPOINT, OPT_CHECKPOINT_INTERVAL, OPT_RESUME,
+		OPT_PROCESSES, OPT_SOCKET, OPT_CONNECT, OPT_SHM, OPT_TT, OPT_IMPROVE, OPT_HELD_KARP, OPT_ELIMINATE, OPT_ASSIGNMENT, OPT_FRONTIER,
+		OPT_MEMORY, OPT_SPILL_DIR, OPT_ADAPTIVE };
+
+	static const struct option longopts[] = {
+		{ "time-limit", required_argument, 0, OPT_TIME_LIMIT },
+		{ "node-limit", required_argument, 0, OPT_NODE_LIMIT },
+		{ "checkpoint", required_argument, 0, OPT_CHECKPOINT },
+		{ "checkpoint-interval", required_argument, 0, OPT_CHECKPOINT_INTERVAL },
+		{ "resume", required_argument, 0, OPT_RESUME },
+		{ "processes", required_argument, 0, OPT_PROCESSES },
+		{ "socket", required_argument, 0, OPT_SOCKET },
+		{ "connect", required_argument, 0, OPT_CONNECT },
+		{ "shm", no_argument, 0, OPT_SHM },
+		{ "tt", required_argument, 0, OPT_TT },
+		{ "improve", no_argument, 0, OPT_IMPROVE },
+		{ "held-karp", required_argument, 0, OPT_HELD_KARP },
+		{ "eliminate", no_argument, 0, OPT_ELIMINATE },
+		{ "assignment", no_argument, 0, OPT_ASSIGNMENT },
+		{ "frontier", required_argument, 0, OPT_FRONTIER },
+		{ "memory", required_argument, 0, OPT_MEMORY },
+		{ "spill-dir", required_argument, 0, OPT_SPILL_DIR },
+		{ "adaptive", no_argument, 0, OPT_ADAPTIVE },
+		{ 0, 0, 0, 0 }
+	};
+
+	int opt;
+	while ((opt = getopt_long(argc, argv, "v::t:pq:e:", longopts, 0)) != -1) {
+		switch (opt) {
+			case OPT_TIME_LIMIT:
+				options.timeLimit = atof(optarg);
+				if (options.timeLimit <= 0)
+					usage(argv[0]);
+				break;
+			case OPT_NODE_LIMIT:
+				options.nodeLimit = atol(optarg);
+				if (options.nodeLimit <= 0)
+					usage(argv[0]);
+				break;
+			case OPT_CHECKPOINT:
+				options.checkpoint = optarg;
+				break;
+			case OPT_CHECKPOINT_INTERVAL:
+				options.checkpointInterval = atof(optarg);
+				if (options.checkpointInterval <= 0)
+					usage(argv[0]);
+				break;
+			case OPT_RESUME:
+				resume = optarg;
+				break;
+			case OPT_PROCESSES:
+				processes = atoi(optarg);
+				if (processes < 1)
+					usage(argv[0]);
+				break;
+			case OPT_SOCKET:
+				socket = optarg;
+				break;
+			case OPT_CONNECT:
+				connect = optarg;
+				break;
+			case OPT_SHM:
+				shm = true;
+				break;
+			case OPT_TT:
+				if (atof(optarg) <= 0)
+					usage(argv[0]);
+				options.tt = atof(optarg);
+				break;
+			case OPT_IMPROVE:
+				options.improve = true;
+				break;
+			case OPT_HELD_KARP: {
+				char* end;
+				long iterations = strtol(optarg, &end, 10);
+				if (end == optarg || *end || iterations < 0 || iterations > INT_MAX)
+					usage(argv[0]);
+				options.heldKarp = iterations;
+				break;
+			}
+			case OPT_ELIMINATE:
+				options.eliminate = true;
+				break;
+			case OPT_ASSIGNMENT:
+				options.assignment = true;
+				break;
+			case OPT_FRONTIER:
+				if (!strcmp(optarg, "path"))
+					options.frontier = FRONTIER_PATH;
+				else if (!strcmp(optarg, "prefix"))
+					options.frontier = FRONTIER_PREFIX;
+				else
+					usage(argv[0]);
+				break;
+			case OPT_MEMORY:
+				if (atof(optarg) <= 0)
+					usage(argv[0]);
+				options.memory = atof(optarg) * (1 << 20);
+				break;
+			case OPT_SPILL_DIR:
+				options.spillDir = optarg;
+				break;
+			case OPT_ADAPTIVE:
+				options.adaptive = true;
+				break;
+			case 'v':
+				options.verbose = (Verbosity) (optarg ? atoi(optarg) : 1);
+				break;
+			case 't':
+				options.threads = atoi(optarg);
+				if (options.threads < 1)
+					usage(argv[0]);
+				break;
+			case 'p':
+				options.pin = true;
+				break;
+			case 'q':
+				if (!strcmp(optarg, "ms"))
+					options.queue = QUEUE_MS;
+				else if (!strcmp(optarg, "msb"))
+					options.queue = QUEUE_MSB;
+				else if (!strcmp(optarg, "mst"))
+					options.queue = QUEUE_MST;
+				else if (!strcmp(optarg, "ring"))
+					options.queue = QUEUE_RING;
+				else
+					usage(argv[0]);
+				break;
+			case 'e':
+				if (!strcmp(optarg, "bfs"))
+					options.engine = ENGINE_BFS;
+				else if (!strcmp(optarg, "dfs"))
+					options.engine = ENGINE_DFS;
+				else if (!strcmp(optarg, "det"))
+					options.engine = ENGINE_DET;
+				else if (!strcmp(optarg, "heuristic"))
+					options.engine = ENGINE_HEURISTIC;
+#ifdef _OPENMP
+				else if (!strcmp(optarg, "omp"))
+					options.engine = ENGINE_OMP;
+#endif
+				else
+					usage(argv[0]);
+				break;
+			default:
+				usage(argv[0]);
 		}
 	}
+	if (!Solver::valid(options))
+		usage(argv[0]);
+	// worker processes run a plain depth-first search of their own,
+	// which none of the solver's options reach
+	Solver::Options plain;
+	if (processes && (resume || options.threads != plain.threads || options.engine != plain.engine
+			|| options.queue != plain.queue || options.frontier != plain.frontier || options.pin
+			|| options.adaptive || options.memory || options.timeLimit > 0 || options.nodeLimit
+			|| !options.checkpoint.empty() || options.tt > 0 || options.improve
+			|| options.heldKarp >= 0 || options.assignment))
+		usage(argv[0]);
+	if ((socket || shm) && !processes)
+		usage(argv[0]);
+	if (optind != argc - 1)
+		usage(argv[0]);
+	char* fname = argv[optind];
 
-	Graph* g = TSPFile::graph(fname);
+	if (connect)
+		return Distributed::worker(connect, fname);
 
-	global.shortest = new Path(g);
-	for (int i=0; i<g->size(); i++) {
-		global.shortest->add(i);
+	Graph* g = TSPFile::graph(fname);
+	if (g->size() >= Path::MAX && options.engine != ENGINE_HEURISTIC) {
+		fprintf(stderr, "%s: %d cities, at most %d supported but by -e heuristic\n", fname, g->size(), Path::MAX - 1);
+		exit(1);
+	}
+	if (const char* why = Solver::unsupported(options, g)) {
+		fprintf(stderr, "%s: %s\n", fname, why);
+		exit(1);
 	}
-	global.shortest->add(0);
 
-    global.queue = Queue<Path*>();
+	if (options.verbose & VER_GRAPH)
+		std::cout << COLOR.BLUE << g << COLOR.ORIGINAL;
+	if (options.verbose & VER_SHORTER)
+		// called under the incumbent lock, one tour at a time
+		options.incumbent = [&options](const std::vector<int>& tour, int length, double secs) {
+			if (options.engine == ENGINE_HEURISTIC) {
+				// tour length over time: the tours are too long to print
+				std::cout << "shorter: " << length << " after " << secs << "s" << std::endl;
+				return;
+			}
+			std::cout << "shorter: ";
+			print_tour(std::cout, tour, length);
+			std::cout << std::endl;
+		};
 
-    for (int i=1; i<Path::MAX; i++) {
-        Path* p = new Path(g);
-        p->add(i);
-       	global.queue.enqueue(p);
+	Checkpoint::State state;
+	if (resume) {
+		if (!Checkpoint::read(resume, g, state)) {
+			fprintf(stderr, "%s: not a checkpoint of %s\n", resume, fname);
+			exit(1);
+		}
+		if (options.verbose & VER_COUNTERS)
+			std::cout << "resuming " << state.frontier.size() << " paths after " << state.nodes << " nodes\n";
 	}
 
-    std::vector<std::thread> threads;
-    for (int i = 0; i < Path::MAX; i++)
-		threads.push_back(std::thread(threaded_branch_and_bound));
-
-    for (auto &th : threads)
-      	th.join();
+	Solver solver(options);
+	Solver::Result result;
+	if (processes) {
+		Path* shortest = new Path(g);
+		for (int i=0; i<g->size(); i++)
+			shortest->add(i);
+		shortest->add(0);
+		auto start = std::chrono::steady_clock::now();
+		if (shm) {
+			result.nodes = SharedSearch::solve(g, processes, shortest);
+		} else {
+			std::string path = socket ? socket : "/tmp/tspcc-" + std::to_string(getpid()) + ".sock";
+			result.nodes = Distributed::coordinator(g, fname, processes, path,
+				shortest, options.verbose & VER_SHORTER, options.verbose & VER_COUNTERS);
+		}
+		if (result.nodes < 0)
+			exit(1);
+		std::chrono::duration<double> secs = std::chrono::steady_clock::now() - start;
+		for (int i=0; i<shortest->size(); i++)
+			result.tour.push_back(shortest->node(i));
+		result.distance = result.lowerBound = shortest->distance();
+		result.stop = STOP_NONE;
+		result.seconds = result.foundAfter = secs.count();
+	} else {
+		// processes have their own children to stop, and keep the default
+		std::jthread watching = watch_signals();
+		result = resume ? solver.solve(g, state) : solver.solve(g);
+	}
 
-    std::cout << COLOR.RED << "shortest " << global.shortest << COLOR.ORIGINAL << '\n';
+	std::cout << COLOR.RED << "shortest ";
+	print_tour(std::cout, result.tour, result.distance);
+	std::cout << COLOR.ORIGINAL << '\n';
 
-//	if (global.verbose & VER_GRAPH)
-//		std::cout << COLOR.BLUE << g << COLOR.ORIGINAL;
-//
-//	if (global.verbose & VER_COUNTERS)
-//		reset_counters(g->size());
-//
-//	global.shortest = new Path(g);
-//	for (int i=0; i<g->size(); i++) {
-//		global.shortest->add(i);
-//	}
-//	global.shortest->add(0);
-//
-//	Path* current = new Path(g);
-//	current->add(0);
-//	branch_and_bound(current);
-//
-//	std::cout << COLOR.RED << "shortest " << global.shortest << COLOR.ORIGINAL << '\n';
-//
-//	if (global.verbose & VER_COUNTERS)
-//		print_counters();
+	if (result.stop != STOP_NONE || (options.verbose & VER_COUNTERS)) {
+		static const char* reasons[] = { "search complete", "time limit", "node limit", "interrupted",
+			"no shorter tour lately", "spilled paths lost" };
+		std::cout << reasons[result.stop] << " after " << result.nodes << " nodes, " << result.seconds << "s\n";
+		std::cout << "lower bound " << result.lowerBound << ", gap "
+			<< (100. * (result.distance - result.lowerBound) / result.distance) << "%\n";
+		struct rusage usage;
+		if (getrusage(RUSAGE_SELF, &usage) == 0)
+			std::cout << "peak memory " << (usage.ru_maxrss >> 10) << " MB\n";
+	}
+	if (options.verbose & VER_COUNTERS)
+		solver.report(std::cout, result);
+	Profile::report(std::cout);
+	if (CasCount::enabled)
+		CasCount::total().print(std::cout);
 
 	return 0;
 }
@@ -9,19 +9,22 @@
 
 #include <math.h>
 #include <cerrno>
+#include <cstring>
+#include <vector>
 
 #include "graph.hpp"
 
 
 class TSPFile {
 private:
-	static const int MAX_NODES = 100;
+	static const int MAX_NODES = 10000;	// the distances take MAX_NODES^2 ints
 	static const int MAX_CHARS_LINE = 1000;
 
-	enum Weight { EWT_EUC_2D = 1, EWT_GEO, EWT_ERR };
+	enum Weight { EWT_EUC_2D = 1, EWT_GEO, EWT_EXPLICIT, EWT_ERR };
+	enum Format { EWF_FULL_MATRIX = 1, EWF_UPPER_ROW, EWF_LOWER_DIAG_ROW, EWF_ERR };
 	struct Point { double x, y; };
-	static int _linenum;
-	static std::string _filename;
+	static inline int _linenum;
+	static inline std::string _filename;
 
 	static void abort(std::string str, int err = 0)
 	{
@@ -73,10 +76,49 @@ private:
 			return EWT_EUC_2D;
 		} else if (!strncmp("GEO", line, 3)) {
 			return EWT_GEO;
+		} else if (!strncmp("EXPLICIT", line, 8)) {
+			return EWT_EXPLICIT;
 		}
 		return EWT_ERR;
 	}
 
+	static Format scan_format(char* line)
+	{
+		line = trim_line(line, true);
+		if (!strncmp("FULL_MATRIX", line, 11)) {
+			return EWF_FULL_MATRIX;
+		} else if (!strncmp("UPPER_ROW", line, 9)) {
+			return EWF_UPPER_ROW;
+		} else if (!strncmp("LOWER_DIAG_ROW", line, 14)) {
+			return EWF_LOWER_DIAG_ROW;
+		}
+		return EWF_ERR;
+	}
+
+	// weights of an EDGE_WEIGHT_SECTION, row i holding the distances from i
+	static void scan_weights(FILE* f, Graph* g, int size, Format ewf)
+	{
+		for (int i=0; i<size; i++) {
+			g->add(0, 0);
+			g->sdistance(i, i) = 0;
+		}
+		for (int i=0; i<size; i++) {
+			int from = 0, to = size;
+			if (ewf == EWF_UPPER_ROW)
+				from = i + 1;
+			else if (ewf == EWF_LOWER_DIAG_ROW)
+				to = i + 1;
+			for (int j=from; j<to; j++) {
+				int dist;
+				if (fscanf(f, "%d", &dist) != 1)
+					abort("missing weights in input file");
+				g->sdistance(i, j) = dist;
+				if (ewf != EWF_FULL_MATRIX)
+					g->sdistance(j, i) = dist;
+			}
+		}
+	}
+
 	static Point scan_point(char* line, int i)
 	{
 		Point point;
@@ -113,8 +155,8 @@ public:
 		int size = 0;
 		char line[MAX_CHARS_LINE];
 		char* tline;
-		Point vec[MAX_NODES];
 		Weight ewt = EWT_EUC_2D;
+		Format ewf = EWF_ERR;
 	
 		_linenum = 0;
 		_filename = fname;
@@ -131,11 +173,22 @@ public:
 				size = scan_size(tline);
 			} else if (!strncmp("EDGE_WEIGHT_TYPE", tline, 16)) {
 				ewt = scan_weight(tline);
-			} else if (!strncmp("NODE_COORD_SECTION", line, 18))
+			} else if (!strncmp("EDGE_WEIGHT_FORMAT", tline, 18)) {
+				ewf = scan_format(tline);
+			} else if (!strncmp("NODE_COORD_SECTION", line, 18) || !strncmp("EDGE_WEIGHT_SECTION", line, 19))
 				break;
 			if (feof(f))
 				abort(fname.c_str(), errno);
 		}
+		if (ewt == EWT_EXPLICIT) {
+			if (ewf == EWF_ERR)
+				abort("wrong EDGE_WEIGHT_FORMAT parameter");
+			Graph* g = new Graph(size);
+			scan_weights(f, g, size, ewf);
+			fclose(f);
+			return g;
+		}
+		std::vector<Point> vec(size);
 		for (int i=0; i<size; i++) {
 			fgets(line, MAX_CHARS_LINE-1, f);
 			tline = trim_line(line);
@@ -157,6 +210,7 @@ public:
 					case EWT_EUC_2D:
 						dist = sqdist(vec[i].x, vec[i].y, vec[j].x, vec[j].y);
 						break;
+					case EWT_EXPLICIT:
 					case EWT_ERR:
 						abort("wrong EDGE_WEIGHT_TYPE parameter");
 				}
@@ -167,9 +221,20 @@ public:
 		return g;
 	}
 
-};
+	// the graph of the cities at x, y, with EUC_2D distances
+	static Graph* euclidean(const std::vector<double>& x, const std::vector<double>& y)
+	{
+		int size = x.size();
+		Graph* g = new Graph(size);
+		for (int i=0; i<size; i++) {
+			g->add(x[i], y[i]);
+			g->sdistance(i, i) = 0;
+			for (int j=0; j<i; j++)
+				g->sdistance(j, i) = g->sdistance(i, j) = sqdist(x[i], y[i], x[j], y[j]);
+		}
+		return g;
+	}
 
-int TSPFile::_linenum;
-std::string TSPFile::_filename;
+};
 
 #endif //  _tspfile_hpp